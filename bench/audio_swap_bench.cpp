@@ -0,0 +1,79 @@
+// Check and benchmark for swap_stereo_halves: runs the SIMD version against
+// the plain per-byte loop over a synthetic RDRAM buffer, at every alignment
+// and for lengths that leave a scalar tail. Exits non-zero on a mismatch.
+
+#include "audio_swap.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static void swap_scalar(const uint8_t* src, uint8_t* dst, size_t samples) {
+    for (size_t i = 0; i < samples; i++) {
+        dst[i * 4 + 0] = src[i * 4 + 2];
+        dst[i * 4 + 1] = src[i * 4 + 3];
+        dst[i * 4 + 2] = src[i * 4 + 0];
+        dst[i * 4 + 3] = src[i * 4 + 1];
+    }
+}
+
+// Seconds per call, best of a few runs
+template <typename F>
+static double time_swap(F swap, const uint8_t* src, uint8_t* dst, size_t samples, int reps) {
+    double best = 1e9;
+    for (int run = 0; run < 5; run++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < reps; r++) swap(src, dst, samples);
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / reps;
+        if (s < best) best = s;
+    }
+    return best;
+}
+
+int main() {
+    // 8 MB, like the N64's expanded RDRAM
+    const size_t rdram_size = 8 << 20;
+    std::vector<uint8_t> rdram(rdram_size + 16);
+    unsigned int seed = 12345;
+    for (auto& b : rdram) {
+        seed = seed * 1103515245 + 12345;
+        b = (uint8_t)(seed >> 16);
+    }
+
+    // Correctness: AI buffers start on any 8-byte DMA address, lengths vary
+    std::vector<uint8_t> expect(rdram_size), got(rdram_size);
+    const size_t lengths[] = { 0, 1, 3, 4, 5, 7, 8, 17, 735, 1024, 1601 };
+    for (size_t offset = 0; offset < 16; offset++) {
+        for (size_t samples : lengths) {
+            swap_scalar(rdram.data() + offset, expect.data(), samples);
+            memset(got.data(), 0, samples * 4);
+            swap_stereo_halves(rdram.data() + offset, got.data(), samples);
+            if (memcmp(expect.data(), got.data(), samples * 4) != 0) {
+                printf("FAIL: mismatch at offset %zu, %zu samples\n", offset, samples);
+                return 1;
+            }
+        }
+    }
+#if defined(AUDIO_CAPTURE_SSE2)
+    const char* simd = "SSE2";
+#elif defined(AUDIO_CAPTURE_NEON)
+    const char* simd = "NEON";
+#else
+    const char* simd = "none (scalar build)";
+#endif
+    printf("swap_stereo_halves matches the scalar loop (SIMD: %s)\n", simd);
+
+    // Throughput: a typical ~1/60 s AI buffer at 32 kHz, and the whole RDRAM
+    const size_t sizes[] = { 536, rdram_size / 4 };
+    for (size_t samples : sizes) {
+        int reps = samples < 4096 ? 20000 : 20;
+        double scalar = time_swap(swap_scalar, rdram.data(), got.data(), samples, reps);
+        double vector = time_swap(swap_stereo_halves, rdram.data(), got.data(), samples, reps);
+        double mb = samples * 4 / (1024.0 * 1024.0);
+        printf("%8zu samples: scalar %8.2f us (%6.0f MB/s), swap_stereo_halves %8.2f us (%6.0f MB/s), %.1fx\n",
+               samples, scalar * 1e6, mb / scalar, vector * 1e6, mb / vector, scalar / vector);
+    }
+    return 0;
+}
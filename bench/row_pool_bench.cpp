@@ -0,0 +1,79 @@
+// Pool-size sweep for the frame flip: runs frame_capture's bottom-up to
+// top-down row copy through a RowPool at 720p, 1440p and 2160p for every
+// band count up to the core count, and reports per-frame latency and the
+// speedup over a single band. Use it to check where extra flip threads stop
+// paying off on a machine (auto_worker_threads in frame_capture.cpp picks
+// one band per ~2 MB of frame, up to half the cores).
+
+#include "row_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Same copy as frame_capture's flip_rows
+static void flip_rows(RowPool& pool, uint8_t* dst, const uint8_t* src, int width, int height) {
+    size_t stride = (size_t)width * 3;
+    pool.run(height, [=](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            memcpy(dst + y * stride, src + (height - 1 - y) * stride, stride);
+        }
+    });
+}
+
+// Milliseconds per frame, best of a few runs
+static double time_flip(RowPool& pool, uint8_t* dst, const uint8_t* src, int width, int height, int frames) {
+    double best = 1e9;
+    for (int run = 0; run < 3; run++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++) flip_rows(pool, dst, src, width, height);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+        if (ms < best) best = ms;
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    int frames = 100;
+    int max_bands = std::max(1, (int)std::thread::hardware_concurrency());
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-bands") == 0 && i + 1 < argc) {
+            max_bands = atoi(argv[++i]);
+        } else {
+            printf("Usage: %s [--frames <n>] [--max-bands <n>]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (frames <= 0 || max_bands <= 0) {
+        fprintf(stderr, "Error: bad frame or band count\n");
+        return 1;
+    }
+
+    const int sizes[][2] = { { 1280, 720 }, { 2560, 1440 }, { 3840, 2160 } };
+    for (const auto& size : sizes) {
+        int width = size[0], height = size[1];
+        size_t frame_size = (size_t)width * height * 3;
+        std::vector<uint8_t> src(frame_size), dst(frame_size);
+        for (size_t i = 0; i < frame_size; i++) src[i] = (uint8_t)(i * 7);
+
+        printf("%dx%d (%.1f MB per frame)\n", width, height, frame_size / (1024.0 * 1024.0));
+        double single = 0;
+        for (int bands = 1; bands <= max_bands; bands++) {
+            RowPool pool;
+            pool.start(bands - 1);
+            double ms = time_flip(pool, dst.data(), src.data(), width, height, frames);
+            pool.stop();
+            if (bands == 1) single = ms;
+            printf("  %2d band(s): %7.3f ms/frame, %6.0f MB/s, %.2fx\n", bands, ms,
+                   frame_size / (1024.0 * 1024.0) / (ms / 1000.0), single / ms);
+        }
+    }
+    return 0;
+}
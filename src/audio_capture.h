@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 
 // Function pointer types for the audio capture plugin's custom exports.
 // Resolved via GetProcAddress after loading the DLL.
@@ -6,3 +7,26 @@
 typedef void (*ptr_audio_capture_set_output)(const char* path);
 typedef unsigned int (*ptr_audio_capture_get_frequency)(void);
 typedef unsigned long long (*ptr_audio_capture_get_bytes_written)(void);
+
+// Live audio sink: receives each AiLenChanged chunk as interleaved s16le stereo
+// at the current AI frequency. Called on the emulation thread.
+typedef void (*audio_capture_callback)(const void* pcm, unsigned int bytes,
+                                       unsigned int frequency, void* context);
+typedef void (*ptr_audio_capture_set_callback)(audio_capture_callback callback, void* context);
+
+// Shared PCM ring, owned by the host: the plugin appends interleaved s16le
+// stereo on the emulation thread and exactly one host thread consumes it.
+// head and tail count bytes since the ring was opened; size is a power of
+// two. The plugin waits (never drops audio) while the ring is full, so the
+// host must drain it for as long as emulation runs.
+struct AudioCaptureRing {
+    unsigned char* data;
+    unsigned long long size;
+    std::atomic<unsigned long long> head;  // advanced by the plugin (release)
+    std::atomic<unsigned long long> tail;  // advanced by the host (release)
+    std::atomic<unsigned int> frequency;   // AI rate of the audio pushed last, set before head
+};
+// Switch capture from the output file to the host's ring (head and tail at 0),
+// or detach it again with nullptr. Call before RomOpen; the ring must stay
+// valid until it is detached, which the host does once emulation has ended.
+typedef void (*ptr_audio_capture_open_ring)(AudioCaptureRing* ring);
@@ -1,9 +1,19 @@
 // Minimal mupen64plus audio plugin that captures raw PCM audio to a file.
-// No speaker output. Used by Krec2MP4 for encoding audio into the output MP4.
+// No speaker output. Used by Krec2MP4 for encoding audio into the output MP4,
+// either via a temp file or handed live to the host through a callback.
 
+#include "audio_capture.h"
+#include "audio_swap.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <cstdint>
 #include <cstring>
+#include <filesystem>
+#include <thread>
+#include <vector>
 
 #ifdef _WIN32
 #define EXPORT __declspec(dllexport)
@@ -47,7 +57,109 @@ static AUDIO_INFO s_audio_info = {};
 static FILE* s_output_file = nullptr;
 static char s_output_path[1024] = {};
 static unsigned int s_frequency = 33600;  // default
-static unsigned long long s_bytes_written = 0;
+// Capture file: bytes that reached it and bytes lost to failed writes (the
+// writer thread counts both). Without a file every captured byte counts as
+// written.
+static std::atomic<unsigned long long> s_bytes_written{0};
+static std::atomic<unsigned long long> s_bytes_failed{0};
+static audio_capture_callback s_callback = nullptr;
+static void* s_callback_context = nullptr;
+static std::vector<uint8_t> s_chunk; // converted PCM handed to the callback
+
+// stdio buffer for the capture file: AiLenChanged chunks are a few KB, so
+// this turns ~100 chunk writes into one write() to disk
+static const size_t OUTPUT_FILE_BUFFER = 256 * 1024;
+
+// AiLenChanged (emulation thread) pushes converted PCM into a single-producer/
+// single-consumer byte ring. Either it is our own, drained by the writer
+// thread to the capture file so disk latency never stalls emulation unless
+// the ring fills, or the host's own (audio_capture_open_ring), which the host
+// drains. Only the producer moves head and only the consumer moves tail.
+// 4 MB holds ~20 s of 48 kHz stereo.
+static const size_t RING_SIZE = 4 << 20;  // power of two
+static const int WRITER_IDLE_MS = 2;
+static const int RING_FULL_SLEEP_US = 500;
+static std::vector<uint8_t> s_ring_buffer;
+static AudioCaptureRing s_ring = {};
+static AudioCaptureRing* s_host_ring = nullptr;  // host consumes it; no capture file
+static std::atomic<bool> s_writer_stop{false};
+static std::thread s_writer;
+// Backpressure: times the emulation thread found the ring full, how long it
+// waited for the writer, and the highest fill seen
+static unsigned long long s_ring_waits = 0;
+static double s_ring_wait_seconds = 0;
+static unsigned long long s_ring_peak = 0;
+
+static void reset_ring_stats() {
+    s_ring_waits = 0;
+    s_ring_wait_seconds = 0;
+    s_ring_peak = 0;
+}
+
+static void reset_ring() {
+    s_ring_buffer.resize(RING_SIZE);
+    s_ring.data = s_ring_buffer.data();
+    s_ring.size = RING_SIZE;
+    s_ring.head.store(0);
+    s_ring.tail.store(0);
+    reset_ring_stats();
+}
+
+static void writer_main() {
+    while (true) {
+        unsigned long long tail = s_ring.tail.load(std::memory_order_relaxed);
+        unsigned long long head = s_ring.head.load(std::memory_order_acquire);
+        if (head == tail) {
+            // Stop only once everything pushed before the stop has been written
+            if (s_writer_stop.load(std::memory_order_acquire) &&
+                s_ring.head.load(std::memory_order_acquire) == tail) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(WRITER_IDLE_MS));
+            continue;
+        }
+        size_t offset = (size_t)(tail & (RING_SIZE - 1));
+        size_t bytes = (size_t)std::min<unsigned long long>(head - tail, RING_SIZE - offset);
+        size_t written = fwrite(s_ring.data + offset, 1, bytes, s_output_file);
+        s_bytes_written.fetch_add(written, std::memory_order_relaxed);
+        if (written != bytes) {
+            // Keep draining so emulation never blocks on a broken file; the
+            // host sees the loss in the written count
+            if (s_bytes_failed.load(std::memory_order_relaxed) == 0) {
+                fprintf(stderr, "AudioCapture: write to '%s' failed\n", s_output_path);
+            }
+            s_bytes_failed.fetch_add(bytes - written, std::memory_order_relaxed);
+        }
+        s_ring.tail.store(tail + bytes, std::memory_order_release);
+    }
+}
+
+// Emulation thread: copy PCM into the ring, waiting for its consumer only
+// when the ring is full (audio is never dropped)
+static void ring_push(AudioCaptureRing* ring, const uint8_t* data, size_t bytes) {
+    const unsigned long long size = ring->size;
+    // Published with the head below, so the consumer never has to ask us
+    ring->frequency.store(s_frequency, std::memory_order_relaxed);
+    while (bytes > 0) {
+        unsigned long long head = ring->head.load(std::memory_order_relaxed);
+        unsigned long long used = head - ring->tail.load(std::memory_order_acquire);
+        if (used == size) {
+            auto start = std::chrono::steady_clock::now();
+            s_ring_waits++;
+            while (head - ring->tail.load(std::memory_order_acquire) == size) {
+                std::this_thread::sleep_for(std::chrono::microseconds(RING_FULL_SLEEP_US));
+            }
+            s_ring_wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            continue;
+        }
+        size_t offset = (size_t)(head & (size - 1));
+        size_t n = (size_t)std::min<unsigned long long>(
+            std::min<unsigned long long>(bytes, size - used), size - offset);
+        memcpy(ring->data + offset, data, n);
+        ring->head.store(head + n, std::memory_order_release);
+        if (used + n > s_ring_peak) s_ring_peak = used + n;
+        data += n;
+        bytes -= n;
+    }
+}
 
 // --- Custom exports for main app ---
 
@@ -56,6 +168,20 @@ extern "C" {
 EXPORT void CALL audio_capture_set_output(const char* path) {
     strncpy(s_output_path, path, sizeof(s_output_path) - 1);
     s_output_path[sizeof(s_output_path) - 1] = 0;
+    s_host_ring = nullptr;
+}
+
+EXPORT void CALL audio_capture_open_ring(AudioCaptureRing* ring) {
+    if (ring) {
+        s_output_path[0] = 0;
+        reset_ring_stats();
+    }
+    s_host_ring = ring;
+}
+
+EXPORT void CALL audio_capture_set_callback(audio_capture_callback callback, void* context) {
+    s_callback = callback;
+    s_callback_context = context;
 }
 
 EXPORT unsigned int CALL audio_capture_get_frequency(void) {
@@ -63,7 +189,7 @@ EXPORT unsigned int CALL audio_capture_get_frequency(void) {
 }
 
 EXPORT unsigned long long CALL audio_capture_get_bytes_written(void) {
-    return s_bytes_written;
+    return s_bytes_written.load();
 }
 
 // --- Standard m64p audio plugin exports ---
@@ -102,24 +228,57 @@ EXPORT int CALL InitiateAudio(AUDIO_INFO Audio_Info) {
 }
 
 EXPORT int CALL RomOpen(void) {
-    s_bytes_written = 0;
-    fprintf(stderr, "AudioCapture: RomOpen called, output='%s'\n", s_output_path);
+    s_bytes_written.store(0);
+    s_bytes_failed.store(0);
+    fprintf(stderr, "AudioCapture: RomOpen called, output='%s'\n",
+            s_host_ring ? "<host ring>" : s_output_path);
     if (s_output_path[0]) {
         s_output_file = fopen(s_output_path, "wb");
         if (!s_output_file) {
             fprintf(stderr, "AudioCapture: failed to open '%s'\n", s_output_path);
             return 0;
         }
+        setvbuf(s_output_file, nullptr, _IOFBF, OUTPUT_FILE_BUFFER);
+
+        reset_ring();
+        s_writer_stop.store(false);
+        s_writer = std::thread(writer_main);
     }
     return 1;
 }
 
 EXPORT void CALL RomClosed(void) {
-    fprintf(stderr, "AudioCapture: RomClosed called, bytes_written=%llu\n", s_bytes_written);
+    fprintf(stderr, "AudioCapture: RomClosed called\n");
+    if (s_host_ring) {
+        fprintf(stderr, "AudioCapture: host ring peak %llu KB, emulation waited %llu times (%.1f ms)\n",
+                s_ring_peak / 1024, s_ring_waits, s_ring_wait_seconds * 1000.0);
+    }
+    if (s_writer.joinable()) {
+        // The writer drains whatever is still queued before it exits
+        s_writer_stop.store(true, std::memory_order_release);
+        s_writer.join();
+        fprintf(stderr, "AudioCapture: writer ring peak %llu KB, emulation waited %llu times (%.1f ms)\n",
+                s_ring_peak / 1024, s_ring_waits, s_ring_wait_seconds * 1000.0);
+    }
     if (s_output_file) {
-        fclose(s_output_file);
+        bool closed = fclose(s_output_file) == 0;
         s_output_file = nullptr;
+        if (!closed) fprintf(stderr, "AudioCapture: closing '%s' failed\n", s_output_path);
+        if (!closed || s_bytes_failed.load() > 0) {
+            // Only what actually reached the file can be muxed (a failed close
+            // may have lost part of the tail still buffered in stdio)
+            unsigned long long total = s_bytes_written.load() + s_bytes_failed.load();
+            std::error_code ec;
+            unsigned long long size = std::filesystem::file_size(s_output_path, ec);
+            if (!ec) {
+                size = std::min(size, total);
+                s_bytes_written.store(size);
+                s_bytes_failed.store(total - size);
+            }
+        }
     }
+    fprintf(stderr, "AudioCapture: bytes_written=%llu, failed=%llu\n",
+            s_bytes_written.load(), s_bytes_failed.load());
 }
 
 EXPORT void CALL AiDacrateChanged(int SystemType) {
@@ -136,28 +295,28 @@ EXPORT void CALL AiDacrateChanged(int SystemType) {
 }
 
 EXPORT void CALL AiLenChanged(void) {
-    if (!s_output_file || !s_audio_info.RDRAM) return;
+    if ((!s_output_file && !s_host_ring && !s_callback) || !s_audio_info.RDRAM) return;
 
     unsigned int addr = *s_audio_info.AI_DRAM_ADDR_REG & 0xFFFFFF;
     unsigned int len = *s_audio_info.AI_LEN_REG;
     if (len == 0) return;
 
     const uint8_t* src = s_audio_info.RDRAM + addr;
-
-    // N64 audio: big-endian stereo 16-bit samples stored as 32-bit words.
-    // On little-endian host, RDRAM contains [Right_Lo, Right_Hi, Left_Lo, Left_Hi]
-    // We need S16LE interleaved: [Left_Lo, Left_Hi, Right_Lo, Right_Hi]
-    // So swap the two 16-bit halves of each 32-bit word.
     unsigned int num_samples = len / 4;
-    for (unsigned int i = 0; i < num_samples; i++) {
-        uint8_t out[4];
-        out[0] = src[i * 4 + 2]; // Left Lo
-        out[1] = src[i * 4 + 3]; // Left Hi
-        out[2] = src[i * 4 + 0]; // Right Lo
-        out[3] = src[i * 4 + 1]; // Right Hi
-        fwrite(out, 1, 4, s_output_file);
+    s_chunk.resize((size_t)num_samples * 4);
+    uint8_t* out = s_chunk.data();
+    swap_stereo_halves(src, out, num_samples);
+
+    if (s_callback) {
+        s_callback(out, num_samples * 4, s_frequency, s_callback_context);
+    }
+    if (s_host_ring) {
+        ring_push(s_host_ring, out, (size_t)num_samples * 4);
+    } else if (s_output_file) {
+        ring_push(&s_ring, out, (size_t)num_samples * 4);
     }
-    s_bytes_written += (unsigned long long)num_samples * 4;
+    // With a capture file, the writer counts what reaches it
+    if (!s_output_file) s_bytes_written.fetch_add((unsigned long long)num_samples * 4, std::memory_order_relaxed);
 }
 
 EXPORT void CALL ProcessAList(void) {}
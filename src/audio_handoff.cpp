@@ -0,0 +1,110 @@
+#include "audio_handoff.h"
+#include "converter.h"
+#include "subprocess.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Poll interval while the ring is empty (a 4 MB ring holds ~30 s of N64 audio)
+static const int HANDOFF_IDLE_MS = 5;
+static const size_t HANDOFF_RING_SIZE = 4 << 20;  // power of two
+
+static std::vector<uint8_t> s_ring_buffer;
+static AudioCaptureRing s_ring_storage = {};
+static AudioCaptureRing* s_ring = nullptr;
+static std::thread s_thread;
+static std::atomic<bool> s_stop{false};
+static AudioHandoffResult s_result;
+
+// Encoder mode
+static std::function<std::string(unsigned int)> s_encoder_cmd;
+static InputProcess* s_encoder = nullptr;
+static bool s_encoder_failed = false;
+
+// Keep or encode one contiguous piece of the ring
+static void consume(const uint8_t* data, size_t bytes) {
+    s_result.bytes += bytes;
+    if (!s_encoder_cmd) {
+        s_result.pcm.insert(s_result.pcm.end(), data, data + bytes);
+        return;
+    }
+    if (s_encoder_failed) return;  // keep draining so emulation never blocks
+    if (!s_encoder) {
+        unsigned int rate = s_ring->frequency.load(std::memory_order_relaxed);
+        if (rate == 0) rate = 33600;
+        std::string cmd = s_encoder_cmd(rate);
+        converter_log(LOG_VERBOSE, "Audio encode cmd: %s", cmd.c_str());
+        s_encoder = start_input_process(cmd);
+        if (!s_encoder) {
+            converter_log(LOG_ERROR, "Error: failed to start the audio encoder: %s", cmd.c_str());
+            s_encoder_failed = true;
+            return;
+        }
+        s_result.encoded_rate = rate;
+    }
+    if (!input_process_write(s_encoder, data, bytes)) {
+        converter_log(LOG_ERROR, "Error: the audio encoder stopped taking input");
+        s_encoder_failed = true;
+    }
+}
+
+// Take everything currently in the ring. Returns the bytes taken.
+static size_t drain() {
+    unsigned long long tail = s_ring->tail.load(std::memory_order_relaxed);
+    unsigned long long head = s_ring->head.load(std::memory_order_acquire);
+    size_t taken = 0;
+    while (tail != head) {
+        size_t offset = (size_t)(tail & (s_ring->size - 1));
+        size_t bytes = (size_t)std::min<unsigned long long>(head - tail, s_ring->size - offset);
+        consume(s_ring->data + offset, bytes);
+        tail += bytes;
+        taken += bytes;
+    }
+    s_ring->tail.store(tail, std::memory_order_release);
+    return taken;
+}
+
+static void handoff_main() {
+    while (!s_stop.load(std::memory_order_acquire)) {
+        if (drain() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(HANDOFF_IDLE_MS));
+    }
+}
+
+AudioCaptureRing* audio_handoff_start(std::function<std::string(unsigned int frequency)> encoder_cmd) {
+    s_ring_buffer.resize(HANDOFF_RING_SIZE);
+    s_ring_storage.data = s_ring_buffer.data();
+    s_ring_storage.size = HANDOFF_RING_SIZE;
+    s_ring_storage.head.store(0);
+    s_ring_storage.tail.store(0);
+    s_ring_storage.frequency.store(0);
+    s_ring = &s_ring_storage;
+    s_result = AudioHandoffResult();
+    s_encoder_cmd = std::move(encoder_cmd);
+    s_encoder = nullptr;
+    s_encoder_failed = false;
+    s_stop.store(false);
+    s_thread = std::thread(handoff_main);
+    return s_ring;
+}
+
+AudioHandoffResult audio_handoff_finish() {
+    if (!s_thread.joinable()) return AudioHandoffResult();
+    s_stop.store(true, std::memory_order_release);
+    s_thread.join();
+    drain();
+    s_ring = nullptr;
+
+    if (s_encoder) {
+        int exit_code = finish_input_process(s_encoder);
+        s_encoder = nullptr;
+        if (exit_code != 0) {
+            converter_log(LOG_ERROR, "Error: the audio encoder failed (%d)", exit_code);
+            s_encoder_failed = true;
+        }
+        s_result.encoded = !s_encoder_failed;
+    }
+    s_encoder_cmd = nullptr;
+    return std::move(s_result);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "audio_capture.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Host side of the capture plugin's shared ring (audio_capture_open_ring).
+// The ring lives here, not in the plugin, so it outlives the plugin library.
+// A thread drains the ring for as long as emulation runs, so no temp audio
+// file is written. The PCM is either kept in memory for the mux pass or
+// streamed straight into an audio encoder process, which then finishes
+// together with emulation. The plugin only waits on us if this falls a whole
+// ring behind.
+
+struct AudioHandoffResult {
+    std::vector<uint8_t> pcm;       // memory mode: everything captured
+    unsigned long long bytes = 0;   // PCM bytes taken from the ring
+    unsigned int encoded_rate = 0;  // encoder mode: rate the encoder was started at (0 = never started)
+    bool encoded = false;           // encoder mode: the encoder took every byte and exited cleanly
+};
+
+// Allocate the ring and start draining it. Hand the result to
+// audio_capture_open_ring before RomOpen. With encoder_cmd set, the encoder
+// is started on the first audio with encoder_cmd(frequency), the AI rate the
+// plugin stored in the ring with it, and reads s16le stereo on stdin; nothing
+// is kept in memory.
+AudioCaptureRing* audio_handoff_start(std::function<std::string(unsigned int frequency)> encoder_cmd = nullptr);
+
+// Call once emulation has ended and the ring is detached from the plugin
+// (nothing more is pushed), before the plugin is unloaded: drains the rest,
+// stops the thread, waits for the encoder and returns what was captured.
+AudioHandoffResult audio_handoff_finish();
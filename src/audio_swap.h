@@ -0,0 +1,41 @@
+#pragma once
+// N64 AI sample conversion, shared by the audio capture plugin and
+// bench/audio_swap_bench.cpp.
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define AUDIO_CAPTURE_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define AUDIO_CAPTURE_NEON 1
+#endif
+
+// N64 audio: big-endian stereo 16-bit samples stored as 32-bit words.
+// On little-endian host, RDRAM contains [Right_Lo, Right_Hi, Left_Lo, Left_Hi]
+// We need S16LE interleaved: [Left_Lo, Left_Hi, Right_Lo, Right_Hi]
+// So swap the two 16-bit halves of each 32-bit word.
+static inline void swap_stereo_halves(const uint8_t* src, uint8_t* dst, size_t samples) {
+    size_t i = 0;
+#if defined(AUDIO_CAPTURE_SSE2)
+    // A 16-bit rotate of each dword; SSE2 is enough since no byte shuffle is needed
+    for (; i + 4 <= samples; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        v = _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+        _mm_storeu_si128((__m128i*)(dst + i * 4), v);
+    }
+#elif defined(AUDIO_CAPTURE_NEON)
+    for (; i + 4 <= samples; i += 4) {
+        uint16x8_t v = vld1q_u16((const uint16_t*)(src + i * 4));
+        vst1q_u16((uint16_t*)(dst + i * 4), vrev32q_u16(v));
+    }
+#endif
+    for (; i < samples; i++) {
+        dst[i * 4 + 0] = src[i * 4 + 2]; // Left Lo
+        dst[i * 4 + 1] = src[i * 4 + 3]; // Left Hi
+        dst[i * 4 + 2] = src[i * 4 + 0]; // Right Lo
+        dst[i * 4 + 3] = src[i * 4 + 1]; // Right Hi
+    }
+}
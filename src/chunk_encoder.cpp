@@ -0,0 +1,223 @@
+#include "chunk_encoder.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Frames buffered across all workers. Each worker's queue holds one whole
+// chunk, so the capture side can hand off a chunk and move to the next
+// worker without waiting for the encoder to catch up.
+static const size_t CHUNK_BUFFER_BUDGET = 768u << 20;
+static const int MIN_CHUNK_FRAMES = 30;
+static const int MAX_CHUNK_FRAMES = 300;
+
+struct ChunkFrame {
+    std::vector<uint8_t> data;
+    int chunk;
+};
+
+struct ChunkWorker {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<ChunkFrame> queue;
+    bool done = false;
+};
+
+struct ChunkPool {
+    FFmpegConfig config;           // per-chunk encoder settings (output_path = final output)
+    int chunk_frames = 0;
+    size_t queue_limit = 0;        // frames per worker queue
+    std::vector<std::unique_ptr<ChunkWorker>> workers;
+    int frame_count = 0;
+    std::atomic<bool> failed{false};
+    double queue_fill_sum = 0;   // queue depth / limit, summed per write
+
+    // Recycled frame buffers (returned by workers after each write)
+    std::mutex free_mutex;
+    std::vector<std::vector<uint8_t>> free_buffers;
+    std::vector<uint8_t> acquired;
+};
+
+static std::string chunk_path(const std::string& output_path, int chunk) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".chunk%05d.mp4", chunk);
+    return output_path + suffix;
+}
+
+static std::vector<uint8_t> take_buffer(ChunkPool* pool, size_t size) {
+    std::vector<uint8_t> buf;
+    {
+        std::lock_guard<std::mutex> lock(pool->free_mutex);
+        if (!pool->free_buffers.empty()) {
+            buf = std::move(pool->free_buffers.back());
+            pool->free_buffers.pop_back();
+        }
+    }
+    buf.resize(size);
+    return buf;
+}
+
+static void worker_main(ChunkPool* pool, ChunkWorker* w) {
+    FFmpegEncoder encoder;
+    FFmpegConfig config = pool->config;
+    int current = -1;
+
+    while (true) {
+        ChunkFrame frame;
+        {
+            std::unique_lock<std::mutex> lock(w->mutex);
+            w->cv.wait(lock, [w] { return !w->queue.empty() || w->done; });
+            if (w->queue.empty()) break;
+            frame = std::move(w->queue.front());
+            w->queue.pop_front();
+        }
+        w->cv.notify_all();
+
+        if (frame.chunk != current) {
+            encoder.close();
+            current = frame.chunk;
+            config.output_path = chunk_path(pool->config.output_path, current);
+            if (!pool->failed && !encoder.open(config)) {
+                fprintf(stderr, "Error: failed to open encoder for chunk %d\n", current);
+                pool->failed = true;
+            }
+        }
+        if (!pool->failed && encoder.is_open() &&
+            !encoder.write_frame(frame.data.data(), config.width, config.height)) {
+            pool->failed = true;
+        }
+
+        std::lock_guard<std::mutex> lock(pool->free_mutex);
+        pool->free_buffers.push_back(std::move(frame.data));
+    }
+    encoder.close();
+}
+
+ChunkPool* chunk_pool_open(const FFmpegConfig& config) {
+    ChunkPool* pool = new ChunkPool();
+    pool->config = config;
+    pool->config.chunk_workers = 0;
+    pool->config.audio_rate = 0;
+    pool->config.extra_outputs.clear();
+    pool->config.output_format.clear();
+
+    int workers = config.chunk_workers;
+    size_t frame_size = (size_t)config.width * config.height * 3;
+    pool->chunk_frames = config.chunk_frames;
+    if (pool->chunk_frames <= 0) {
+        // Each worker queues up to a chunk of frames. When the budget can't
+        // give every worker MIN_CHUNK_FRAMES, run fewer workers rather than
+        // shorter chunks or more memory.
+        size_t max_workers = CHUNK_BUFFER_BUDGET / (MIN_CHUNK_FRAMES * frame_size);
+        if (max_workers == 0) {
+            fprintf(stderr, "Error: %dx%d frames are too large for a chunked encode\n",
+                    config.width, config.height);
+            delete pool;
+            return nullptr;
+        }
+        if ((size_t)workers > max_workers) {
+            fprintf(stderr, "Warning: %d chunk workers would not fit in %zu MB of frame buffers, using %zu\n",
+                    workers, CHUNK_BUFFER_BUDGET >> 20, max_workers);
+            workers = (int)max_workers;
+        }
+        size_t fit = CHUNK_BUFFER_BUDGET / ((size_t)workers * frame_size);
+        pool->chunk_frames = (int)std::min<size_t>(fit, MAX_CHUNK_FRAMES);
+    }
+
+    int cores = (int)std::thread::hardware_concurrency();
+    if (pool->config.threads <= 0 && cores > 0) {
+        // Split the cores between the encoder processes instead of letting each grab them all
+        pool->config.threads = std::max(1, cores / workers);
+    }
+    pool->queue_limit = (size_t)pool->chunk_frames;
+
+    fprintf(stderr, "Chunked encode: %d workers, %d frames per chunk, %d threads each\n",
+            workers, pool->chunk_frames, pool->config.threads);
+
+    for (int i = 0; i < workers; i++) {
+        pool->workers.push_back(std::make_unique<ChunkWorker>());
+    }
+    for (auto& w : pool->workers) {
+        w->thread = std::thread(worker_main, pool, w.get());
+    }
+    return pool;
+}
+
+uint8_t* chunk_pool_acquire(ChunkPool* pool, size_t size) {
+    if (pool->acquired.size() != size) pool->acquired = take_buffer(pool, size);
+    return pool->acquired.data();
+}
+
+bool chunk_pool_write_frame(ChunkPool* pool, const uint8_t* rgb_data, int width, int height) {
+    if (pool->failed) return false;
+
+    size_t frame_size = (size_t)width * height * 3;
+    ChunkFrame frame;
+    frame.chunk = pool->frame_count / pool->chunk_frames;
+    if (!pool->acquired.empty() && rgb_data == pool->acquired.data()) {
+        frame.data = std::move(pool->acquired);
+        pool->acquired.clear();
+    } else {
+        frame.data = take_buffer(pool, frame_size);
+        memcpy(frame.data.data(), rgb_data, frame_size);
+    }
+
+    ChunkWorker* w = pool->workers[frame.chunk % pool->workers.size()].get();
+    {
+        std::unique_lock<std::mutex> lock(w->mutex);
+        pool->queue_fill_sum += (double)w->queue.size() / pool->queue_limit;
+        w->cv.wait(lock, [pool, w] { return w->queue.size() < pool->queue_limit || pool->failed; });
+        w->queue.push_back(std::move(frame));
+    }
+    w->cv.notify_all();
+    pool->frame_count++;
+    return !pool->failed;
+}
+
+double chunk_pool_queue_fill(ChunkPool* pool) {
+    return pool->frame_count > 0 ? pool->queue_fill_sum / pool->frame_count : 0;
+}
+
+bool chunk_pool_close(ChunkPool* pool) {
+    for (auto& w : pool->workers) {
+        {
+            std::lock_guard<std::mutex> lock(w->mutex);
+            w->done = true;
+        }
+        w->cv.notify_all();
+    }
+    for (auto& w : pool->workers) {
+        if (w->thread.joinable()) w->thread.join();
+    }
+
+    const std::string& output_path = pool->config.output_path;
+    int chunks = (pool->frame_count + pool->chunk_frames - 1) / pool->chunk_frames;
+    bool ok = !pool->failed && chunks > 0;
+
+    bool keep_chunks = false;
+    if (ok) {
+        std::vector<std::string> paths;
+        for (int i = 0; i < chunks; i++) paths.push_back(chunk_path(output_path, i));
+        ok = ffmpeg_concat_files(pool->config.ffmpeg_path, paths, output_path);
+        // Every chunk is complete, so they are worth keeping for a manual join
+        keep_chunks = !ok;
+        if (keep_chunks) {
+            fprintf(stderr, "Error: joining %d chunks failed; they are kept next to %s\n",
+                    chunks, output_path.c_str());
+        }
+    }
+
+    if (!keep_chunks) {
+        for (int i = 0; i < chunks; i++) remove(chunk_path(output_path, i).c_str());
+    }
+    delete pool;
+    return ok;
+}
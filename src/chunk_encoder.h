@@ -0,0 +1,19 @@
+#pragma once
+#include "ffmpeg_encoder.h"
+
+// Chunked encode (FFmpegConfig::chunk_workers > 1). The frame stream is cut
+// into fixed-length chunks that are handed round-robin to a pool of encoder
+// processes, each chunk starting on a keyframe in its own file. Closing the
+// pool joins the chunks into the output with ffmpeg's concat demuxer
+// (stream copy, no re-encode). Video only: audio is muxed afterwards.
+
+// nullptr if a single worker can't buffer a minimum-length chunk.
+ChunkPool* chunk_pool_open(const FFmpegConfig& config);
+// Buffer the next frame can be rendered into, saving the copy in write_frame.
+uint8_t* chunk_pool_acquire(ChunkPool* pool, size_t size);
+bool chunk_pool_write_frame(ChunkPool* pool, const uint8_t* rgb_data, int width, int height);
+// Mean fill (0-1) of the worker queues, sampled at each write.
+double chunk_pool_queue_fill(ChunkPool* pool);
+// Waits for every chunk, then concatenates. Returns false if any part failed;
+// if only the concat failed, the finished chunks are left in place.
+bool chunk_pool_close(ChunkPool* pool);
@@ -1,12 +1,21 @@
 #include "converter.h"
 #include "audio_capture.h"
+#include "audio_handoff.h"
 #include "krec_parser.h"
 #include "emulator.h"
 #include "pif_replay.h"
 #include "frame_capture.h"
 #include "ffmpeg_encoder.h"
+#include "live_audio.h"
+#include "encoder_tune.h"
+#include "transcode_queue.h"
+#include "output_flusher.h"
+#include "subprocess.h"
 #include "vidext.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstdarg>
 #include <cstring>
@@ -145,22 +154,33 @@ bool check_ffmpeg(const std::string& ffmpeg_path) {
 #endif
 }
 
-std::string make_output_path(const std::string& input_path, const std::string& output_path) {
+std::string make_output_path(const std::string& input_path, const std::string& output_path,
+                             const std::string& format) {
+    if (is_stream_output(output_path)) return output_path;
     fs::path p = output_path.empty() ? fs::path(input_path) : fs::path(output_path);
-    if (p.extension() != ".mp4") {
-        p.replace_extension(".mp4");
+    const char* ext = output_extension(format);
+    if (p.extension() != ext) {
+        p.replace_extension(ext);
     }
     return p.string();
 }
 
-// Mux video + raw audio into final MP4 using FFmpeg
+// Mux video + audio into final MP4 using FFmpeg. The audio is raw s16le from
+// audio_path, or from audio_pcm (fed to ffmpeg's stdin) when that is set; with
+// audio_encoded, audio_path is an already encoded track that is copied as is.
+// output_format selects a streamable container ("fmp4", "mpegts") as for
+// direct outputs.
 static bool mux_video_audio(const std::string& ffmpeg_path,
                              const std::string& video_path,
                              const std::string& audio_path,
+                             bool audio_encoded,
+                             const std::vector<uint8_t>* audio_pcm,
                              unsigned int audio_freq,
                              unsigned long long audio_bytes,
                              int frames_captured,
                              double encode_fps,
+                             const std::string& audio_codec,
+                             const std::string& output_format,
                              const std::string& output_path) {
     // Calculate scale factor to sync video timestamps with actual audio duration.
     // The video was encoded at a fixed FPS (e.g. 60) but the N64's actual rate
@@ -174,91 +194,155 @@ static bool mux_video_audio(const std::string& ffmpeg_path,
     converter_log(LOG_INFO, "A/V sync: video=%.3fs audio=%.3fs scale=%.6f",
                   video_duration, audio_duration, itsscale);
 
+    std::string audio_input = audio_encoded
+        ? "-i \"" + audio_path + "\""
+        : "-f s16le -ar " + std::to_string(audio_freq) + " -ac 2 -i " +
+          (audio_pcm ? std::string("-") : "\"" + audio_path + "\"");
+    std::string audio_flags = audio_encoded ? "-c:a copy" : ffmpeg_audio_flags(audio_codec);
+
     char cmd[4096];
     snprintf(cmd, sizeof(cmd),
-        "\"%s\" -y -itsscale %g -i \"%s\" -f s16le -ar %u -ac 2 -i \"%s\" "
-        "-c:v copy -c:a aac -b:a 192k -shortest \"%s\"",
+        "\"%s\" -y -itsscale %g -i \"%s\" %s "
+        "-c:v copy %s -shortest %s\"%s\"",
         ffmpeg_path.c_str(),
         itsscale,
         video_path.c_str(),
-        audio_freq,
-        audio_path.c_str(),
+        audio_input.c_str(),
+        audio_flags.c_str(),
+        ffmpeg_format_args(output_format).c_str(),
         output_path.c_str());
 
     converter_log(LOG_VERBOSE, "Mux cmd: %s", cmd);
 
-#ifdef _WIN32
-    SECURITY_ATTRIBUTES sa = {};
-    sa.nLength = sizeof(sa);
-    sa.bInheritHandle = TRUE;
-
-    HANDLE read_handle = nullptr, write_handle = nullptr;
-    if (!CreatePipe(&read_handle, &write_handle, &sa, 0)) {
-        converter_log(LOG_ERROR, "Error: failed to create pipe for FFmpeg mux");
+    auto on_line = [](const char* line) {
+        converter_log(LOG_INFO, "[FFmpeg mux] %s", line);
+    };
+    int exit_code = audio_pcm
+        ? run_process_with_input(cmd, audio_pcm->data(), audio_pcm->size(), on_line)
+        : run_process(cmd, on_line);
+    if (exit_code < 0) {
+        converter_log(LOG_ERROR, "Error: failed to run FFmpeg mux command");
         return false;
     }
-    SetHandleInformation(read_handle, HANDLE_FLAG_INHERIT, 0);
-
-    STARTUPINFOA si = {};
-    si.cb = sizeof(si);
-    si.dwFlags = STARTF_USESTDHANDLES;
-    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
-    si.hStdOutput = write_handle;
-    si.hStdError = write_handle;
+    return exit_code == 0;
+}
 
-    PROCESS_INFORMATION pi = {};
-    BOOL ok = CreateProcessA(nullptr, cmd, nullptr, nullptr, TRUE,
-                             CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi);
-    CloseHandle(write_handle);
+// Backpressure summary: where the capture pipeline spent its time and which
+// side limited throughput.
+static void log_pipeline_summary(const FrameCaptureStats& capture, const EncoderStats& enc) {
+    if (capture.frames <= 0 || capture.wall_seconds <= 0) return;
+
+    double wall = capture.wall_seconds;
+    double enc_wall = enc.wall_seconds > 0 ? enc.wall_seconds : wall;
+    converter_log(LOG_INFO, "Pipeline: %d frames in %.1f s (%.1f fps)",
+                  capture.frames, wall, capture.frames / wall);
+    converter_log(LOG_INFO, "  Emulation waited on encode: %.1f s (%.0f%%), %d of %d handoffs blocked",
+                  capture.wait_seconds, 100.0 * capture.wait_seconds / wall,
+                  capture.waits, capture.frames);
+    converter_log(LOG_INFO, "  Encoder writes: %.1f s (%.0f%%), avg %.2f ms, p95 <%.2f ms, max %.1f ms, %.1f MB/s",
+                  enc.write_seconds, 100.0 * enc.write_seconds / enc_wall,
+                  enc.frames ? enc.write_seconds * 1000.0 / enc.frames : 0.0,
+                  encoder_stats_percentile_ms(enc, 0.95), enc.max_write_ms,
+                  enc.bytes / enc_wall / (1024.0 * 1024.0));
+    converter_log(LOG_INFO, "  Encoder stalls (>%.0f ms): %llu, %.1f s",
+                  ENCODER_STALL_MS, enc.stalls, enc.stall_seconds);
+    if (enc.write_calls > 0) {
+        converter_log(LOG_INFO, "  Pipe writes: %llu calls (%.2f per frame), %.2f s CPU in write_frame",
+                      enc.write_calls, enc.frames ? (double)enc.write_calls / enc.frames : 0.0,
+                      enc.write_cpu_seconds);
+    }
+    if (enc.queue_fill >= 0) {
+        converter_log(LOG_INFO, "  Chunk queue fill: %.0f%%", enc.queue_fill * 100.0);
+    }
+    converter_log(LOG_INFO, "  Flip: %.1f s", capture.flip_seconds);
+
+    // Emulation only waits when the encode thread is still busy with the
+    // previous frame; what kept it busy names the bottleneck.
+    const char* verdict;
+    if (capture.wait_seconds < wall * 0.05) {
+        verdict = "emulation (the encoder kept up; a slower preset would cost little)";
+    } else if (enc.write_seconds >= capture.flip_seconds) {
+        verdict = "encoder (ffmpeg drains frames slower than emulation makes them: "
+                  "use a faster preset, more encoder threads or --encode-workers)";
+    } else {
+        verdict = "capture thread (flipping frames: raise --capture-threads)";
+    }
+    converter_log(LOG_INFO, "  Bottleneck: %s", verdict);
+}
 
-    if (!ok) {
-        CloseHandle(read_handle);
-        converter_log(LOG_ERROR, "Error: failed to run FFmpeg mux command (%lu)", GetLastError());
-        return false;
+// Report how a size-targeted encode landed against its target
+static void check_target_size(const std::string& path, double target_mb) {
+    std::error_code ec;
+    auto size = fs::file_size(path, ec);
+    if (ec) return;
+    double mb = size / 1e6;
+    if (mb > target_mb) {
+        converter_log(LOG_WARNING, "Warning: output is %.1f MB, over the %.1f MB target "
+                      "(the replay ran longer than its input count suggests; "
+                      "--capture-lossless gives an exact two-pass encode)", mb, target_mb);
+    } else {
+        converter_log(LOG_INFO, "Output size: %.1f MB (target %.1f MB)", mb, target_mb);
     }
+}
 
-    // Read and log FFmpeg output
-    char buf[512];
-    DWORD bytes_read;
-    std::string line_buf;
-    while (ReadFile(read_handle, buf, sizeof(buf) - 1, &bytes_read, nullptr) && bytes_read > 0) {
-        buf[bytes_read] = 0;
-        line_buf += buf;
-        // Process complete lines
-        size_t pos;
-        while ((pos = line_buf.find('\n')) != std::string::npos) {
-            std::string line = line_buf.substr(0, pos);
-            if (!line.empty() && line.back() == '\r') line.pop_back();
-            if (!line.empty()) converter_log(LOG_INFO, "[FFmpeg mux] %s", line.c_str());
-            line_buf = line_buf.substr(pos + 1);
-        }
+// Hand a finished lossless capture to the transcode queue
+static bool queue_transcode(const std::string& capture_path, const std::string& output_path,
+                            const std::string& preset, int encoder_threads, double duration,
+                            const AppConfig& config) {
+    TranscodeJob job;
+    job.input = capture_path;
+    job.output = output_path;
+    job.encoder = config.encoder;
+    job.crf = config.crf;
+    job.preset = preset;
+    job.threads = encoder_threads;
+    if (!config.native_render.empty()) {
+        // Native-resolution captures are upscaled when they are transcoded
+        job.scale_width = config.res_width;
+        job.scale_height = config.res_height;
+        job.scale_flags = config.native_render;
+    }
+    if (config.target_size_mb > 0) {
+        // The capture's exact duration is known here, unlike before emulation
+        job.bitrate_kbps = target_video_bitrate_kbps(config.target_size_mb, duration,
+                                                     AUDIO_BITRATE_KBPS);
     }
-    if (!line_buf.empty()) converter_log(LOG_INFO, "[FFmpeg mux] %s", line_buf.c_str());
-    CloseHandle(read_handle);
 
-    WaitForSingleObject(pi.hProcess, 60000);
-    DWORD exit_code = 1;
-    GetExitCodeProcess(pi.hProcess, &exit_code);
-    CloseHandle(pi.hProcess);
-    CloseHandle(pi.hThread);
+    std::string queue_dir = config.queue_dir;
+    if (queue_dir.empty()) queue_dir = fs::absolute(output_path).parent_path().string();
+    return transcode_queue_submit(queue_dir, job);
+}
 
-    return exit_code == 0;
-#else
-    std::string full_cmd = std::string(cmd) + " 2>&1";
-    FILE* p = popen(full_cmd.c_str(), "r");
-    if (!p) {
-        converter_log(LOG_ERROR, "Error: failed to run FFmpeg mux command");
-        return false;
+// N64 native framebuffer size, rendered with nativeResFactor 1 by --native-render
+static const int N64_NATIVE_WIDTH = 320;
+static const int N64_NATIVE_HEIGHT = 240;
+
+// Markers closer than this to another split point don't start a new segment
+static const double MIN_MARKER_SEGMENT_SECONDS = 10.0;
+
+// Split points for a segmented output: every segment_minutes, plus chat/drop
+// events when segment_markers is set. Like the target size estimate, this
+// assumes one controller poll per frame to map input frames to video time.
+static std::vector<double> segment_split_times(const KrecData& krec, double fps,
+                                               const AppConfig& config) {
+    double duration = krec.total_input_frames / fps;
+    std::vector<double> times;
+    if (config.segment_minutes > 0) {
+        double step = config.segment_minutes * 60.0;
+        for (double t = step; t < duration; t += step) times.push_back(t);
     }
-    char buf[512];
-    while (fgets(buf, sizeof(buf), p)) {
-        size_t len = strlen(buf);
-        if (len > 0 && buf[len - 1] == '\n') buf[len - 1] = 0;
-        if (buf[0]) converter_log(LOG_INFO, "[FFmpeg mux] %s", buf);
+    if (config.segment_markers) {
+        for (const auto& ev : krec.events) {
+            double t = ev.frame / fps;
+            bool too_close = t < MIN_MARKER_SEGMENT_SECONDS || t > duration - MIN_MARKER_SEGMENT_SECONDS;
+            for (double other : times) {
+                if (fabs(other - t) < MIN_MARKER_SEGMENT_SECONDS) too_close = true;
+            }
+            if (!too_close) times.push_back(t);
+        }
+        std::sort(times.begin(), times.end());
     }
-    int ret = pclose(p);
-    return ret == 0;
-#endif
+    return times;
 }
 
 bool convert_one(const std::string& krec_path, const std::string& output_path,
@@ -284,9 +368,80 @@ bool convert_one(const std::string& krec_path, const std::string& output_path,
         return false;
     }
 
+    // Encoder speed settings: explicit, or picked by trial encodes of this replay
+    std::string preset = config.preset;
+    int encoder_threads = config.encoder_threads;
+    if (config.auto_tune && !config.capture_lossless) {
+        EncoderTuneResult tune;
+        if (encoder_auto_tune(krec_path, krec.header.game_name, config, tune)) {
+            preset = tune.preset;
+            encoder_threads = tune.threads;
+        }
+    }
+
+    // Size-targeted encode: the replay length gives the duration up front. This
+    // assumes one controller poll per VI frame; games that poll less often run
+    // longer than estimated, so the result is checked after encoding.
+    int target_bitrate = 0;
+    if (config.target_size_mb > 0 && !config.capture_lossless) {
+        double duration = krec.total_input_frames / fps;
+        target_bitrate = target_video_bitrate_kbps(config.target_size_mb, duration, AUDIO_BITRATE_KBPS);
+        converter_log(LOG_INFO, "Target size %.1f MB over ~%.1f s: video %d kbps + audio %d kbps",
+                      config.target_size_mb, duration, target_bitrate, AUDIO_BITRATE_KBPS);
+    }
+
+    // Stream outputs can't be muxed afterwards, so they always go direct
+    // (video-only if live audio is unavailable).
+    bool streaming = is_stream_output(output_path);
+
+    // HLS/DASH packages are written segment by segment, so they go direct too
+    bool packaged = is_package_format(config.output_format);
+
+    // Segmented outputs are finished file by file while the capture runs
+    bool segmented = config.segment_minutes > 0 || config.segment_markers;
+
+    // Y4M streams are the final product for an external encoder: nothing to mux
+    bool raw_stream = config.backend == EncoderBackend::Y4M;
+    bool raw_audio_sink = raw_stream && (!streaming || !config.audio_output.empty());
+
+    // Scratch staging: single-file outputs and all their intermediates are
+    // written under scratch_dir, and the finished files are moved to their
+    // destinations in the background.
+    bool staged = !config.scratch_dir.empty() && !streaming && !packaged && !segmented && !raw_stream;
+    auto stage_path = [&](const std::string& path) {
+        return staged ? (fs::path(config.scratch_dir) / fs::path(path).filename()).string() : path;
+    };
+    if (staged) {
+        std::error_code ec;
+        fs::create_directories(config.scratch_dir, ec);
+    }
+
+    // Lossless capture mode writes an intermediate and queues the real encode
+    std::string final_path = output_path;
+    if (config.capture_lossless) {
+        final_path = fs::path(output_path).replace_extension(".capture.mkv").string();
+        converter_log(LOG_INFO, "Lossless capture: %s (%s)", final_path.c_str(),
+                      config.lossless_codec.c_str());
+    }
+    std::string encode_path = stage_path(final_path);
+    if (staged) converter_log(LOG_INFO, "Staging in: %s", encode_path.c_str());
+
     // Temp file paths for two-pass mux
-    std::string temp_video = output_path + ".tmp_v.mp4";
-    std::string temp_audio = output_path + ".tmp_a.raw";
+    std::string temp_video = encode_path + (config.capture_lossless ? ".tmp_v.mkv" : ".tmp_v.mp4");
+    std::string temp_audio = encode_path + ".tmp_a.raw";
+    std::string temp_audio_enc = encode_path + ".tmp_a.m4a";
+
+    // Extra outputs from the same frames; "{stem}" names them per input in batch runs
+    std::vector<FFmpegOutput> extra_outputs = config.extra_outputs;
+    std::vector<std::string> extra_dests;
+    std::string stem = fs::path(krec_path).stem().string();
+    for (auto& out : extra_outputs) {
+        size_t pos = out.path.find("{stem}");
+        if (pos != std::string::npos) out.path.replace(pos, 6, stem);
+        converter_log(LOG_INFO, "Extra output: %s", out.path.c_str());
+        extra_dests.push_back(out.path);
+        out.path = stage_path(out.path);
+    }
 
     // Find audio capture plugin DLL next to the executable
     std::string audio_plugin_path = get_exe_dir() + "AudioCapturePlugin.dll";
@@ -298,8 +453,11 @@ bool convert_one(const std::string& krec_path, const std::string& output_path,
     emu_config.plugin_dir = config.plugin_dir;
     emu_config.data_dir = config.data_dir;
     emu_config.verbose = config.verbose;
-    emu_config.res_width = config.res_width;
-    emu_config.res_height = config.res_height;
+    // Native render: emulation and readback stay at 320x240 and the encoder
+    // upscales to the requested size
+    bool native = !config.native_render.empty();
+    emu_config.res_width = native ? N64_NATIVE_WIDTH : config.res_width;
+    emu_config.res_height = native ? N64_NATIVE_HEIGHT : config.res_height;
     emu_config.msaa = config.msaa;
     emu_config.aniso = config.aniso;
     emu_config.audio_plugin_path = audio_plugin_path;
@@ -313,27 +471,83 @@ bool convert_one(const std::string& krec_path, const std::string& output_path,
     // Configure audio capture plugin
     auto audio_handle = emu.get_audio_plugin_handle();
     ptr_audio_capture_set_output set_output_fn = nullptr;
+    ptr_audio_capture_set_callback set_callback_fn = nullptr;
     ptr_audio_capture_get_frequency get_freq_fn = nullptr;
     ptr_audio_capture_get_bytes_written get_bytes_fn = nullptr;
+    ptr_audio_capture_open_ring open_ring_fn = nullptr;
 
     if (audio_handle) {
         set_output_fn = (ptr_audio_capture_set_output)GetProcAddress(
             (HMODULE)audio_handle, "audio_capture_set_output");
+        set_callback_fn = (ptr_audio_capture_set_callback)GetProcAddress(
+            (HMODULE)audio_handle, "audio_capture_set_callback");
         get_freq_fn = (ptr_audio_capture_get_frequency)GetProcAddress(
             (HMODULE)audio_handle, "audio_capture_get_frequency");
         get_bytes_fn = (ptr_audio_capture_get_bytes_written)GetProcAddress(
             (HMODULE)audio_handle, "audio_capture_get_bytes_written");
+        open_ring_fn = (ptr_audio_capture_open_ring)GetProcAddress(
+            (HMODULE)audio_handle, "audio_capture_open_ring");
     }
 
-    if (set_output_fn) {
+    // Chunked parallel encode: video-only chunks joined at close, so audio
+    // takes the two-pass path.
+    bool chunked = config.encode_workers > 1 && config.backend == EncoderBackend::Pipe &&
+                   !config.capture_lossless && !streaming && !packaged && !segmented &&
+                   config.extra_outputs.empty();
+
+    // Single-pass mode: audio goes live into the same ffmpeg that encodes the
+    // video, which writes the final file directly (no temp files, no mux pass).
+    // The libav backend has no audio input, so it keeps the two-pass path.
+    FFmpegEncoder encoder;
+    bool live_audio = config.capture_audio && config.live_audio && set_callback_fn &&
+                      (config.backend == EncoderBackend::Pipe || raw_audio_sink) && !chunked;
+    bool direct_output = live_audio || streaming || packaged || segmented || raw_stream ||
+                         !config.capture_audio;
+    bool ring_audio = false;
+
+    if (!config.capture_audio) {
+        converter_log(LOG_INFO, "Audio capture disabled.");
+    } else if (live_audio) {
+        live_audio_init(&encoder, fps, frame_capture_submitted_count);
+        set_callback_fn(live_audio_callback, nullptr);
+        converter_log(LOG_INFO, "Audio capture enabled (live, single-pass encode).");
+    } else if (raw_stream && !raw_audio_sink) {
+        converter_log(LOG_WARNING, "Warning: no --audio-output for the Y4M stream, audio is not captured.");
+    } else if (open_ring_fn && !streaming && !packaged && !segmented && !raw_stream) {
+        // Two-pass audio comes through memory. AAC is encoded from it while
+        // emulation runs, leaving only a stream-copy mux afterwards; a lossless
+        // capture's PCM is kept and piped to the mux.
+        std::function<std::string(unsigned int)> encode_cmd;
+        if (!config.capture_lossless) {
+            std::string ffmpeg_path = config.ffmpeg_path;
+            encode_cmd = [ffmpeg_path, temp_audio_enc](unsigned int rate) {
+                return "\"" + ffmpeg_path + "\" -hide_banner -nostats -loglevel error -y -f s16le -ar " +
+                       std::to_string(rate) + " -ac 2 -i - " + ffmpeg_audio_flags("aac") +
+                       " -f mp4 \"" + temp_audio_enc + "\"";
+            };
+        }
+        open_ring_fn(audio_handoff_start(encode_cmd));
+        ring_audio = true;
+        converter_log(LOG_INFO, "Audio capture enabled (in-memory handoff%s).",
+                      encode_cmd ? ", encoded during emulation" : "");
+    } else if (set_output_fn && !streaming && !packaged && !segmented && !raw_stream) {
         set_output_fn(temp_audio.c_str());
         converter_log(LOG_INFO, "Audio capture enabled.");
     } else {
         converter_log(LOG_WARNING, "Warning: audio capture plugin not available, output will have no audio.");
     }
 
+    // The plugin writes into our ring until it is detached, so this runs
+    // before emu.shutdown() unloads it
+    auto finish_ring_audio = [&]() -> AudioHandoffResult {
+        if (!ring_audio) return AudioHandoffResult();
+        open_ring_fn(nullptr);
+        return audio_handoff_finish();
+    };
+
     converter_log(LOG_INFO, "Opening ROM...");
     if (!emu.open_rom(config.rom_path)) {
+        finish_ring_audio();
         emu.shutdown();
         return false;
     }
@@ -345,23 +559,68 @@ bool convert_one(const std::string& krec_path, const std::string& output_path,
     emu.configure_controllers_for_replay(krec.header.num_players);
 
     if (!emu.attach_plugins()) {
+        finish_ring_audio();
         emu.shutdown();
         return false;
     }
 
     emu.apply_deterministic_settings();
 
-    // Setup FFmpeg encoder config (video only, to temp file)
-    // Encoder is opened lazily on first frame to match actual render dimensions
-    FFmpegEncoder encoder;
+    // Setup FFmpeg encoder config (video only to a temp file, or video + live
+    // audio straight to the output). Encoder is opened lazily on first frame
+    // to match actual render dimensions.
     FFmpegConfig ff_config;
     ff_config.ffmpeg_path = config.ffmpeg_path;
-    ff_config.output_path = temp_video;
-    ff_config.width = config.res_width;
-    ff_config.height = config.res_height;
+    ff_config.output_path = direct_output ? encode_path : temp_video;
+    ff_config.output_format = config.output_format;
+    ff_config.ladder = config.ladder;
+    if (segmented) {
+        ff_config.segmented = true;
+        ff_config.segment_times = segment_split_times(krec, fps, config);
+        converter_log(LOG_INFO, "Segmented output: %zu segments, index %s",
+                      ff_config.segment_times.size() + 1, segment_index_path(encode_path).c_str());
+    }
+    ff_config.width = emu_config.res_width;
+    ff_config.height = emu_config.res_height;
+    if (native && !config.capture_lossless) {
+        ff_config.scale_width = config.res_width;
+        ff_config.scale_height = config.res_height;
+        ff_config.scale_flags = config.native_render;
+        converter_log(LOG_INFO, "Native render %dx%d, encoder upscale to %dx%d (%s)",
+                      ff_config.width, ff_config.height, config.res_width, config.res_height,
+                      config.native_render.c_str());
+    }
     ff_config.fps = fps;
+    ff_config.batch_writes = config.batch_writes;
     ff_config.crf = config.crf;
-    ff_config.encoder = config.encoder;
+    ff_config.encoder = config.capture_lossless ? config.lossless_codec : config.encoder;
+    if (!config.capture_lossless) {
+        ff_config.preset = preset;
+        ff_config.threads = encoder_threads;
+        ff_config.bitrate_kbps = target_bitrate;
+    }
+    ff_config.audio_codec = config.capture_lossless ? "pcm_s16le" : "aac";
+    ff_config.backend = config.backend;
+    if (live_audio) ff_config.audio_rate = LIVE_AUDIO_RATE;
+    ff_config.extra_outputs = extra_outputs;
+    // --recover: a crashed ffmpeg is replaced and its output continued in a
+    // new segment. Streams, packages and multi-file outputs can't be joined
+    // afterwards.
+    ff_config.recover = config.recover && !streaming && !packaged && !segmented && !chunked &&
+                        !raw_stream && extra_outputs.empty();
+    if (raw_stream && live_audio) {
+        ff_config.audio_path = config.audio_output;
+        if (ff_config.audio_path.empty() && !streaming) {
+            ff_config.audio_path = fs::path(encode_path).replace_extension(".wav").string();
+        }
+    }
+    if (chunked) {
+        ff_config.chunk_workers = config.encode_workers;
+        ff_config.chunk_frames = config.chunk_frames;
+    }
+    if (!direct_output) {
+        for (auto& out : ff_config.extra_outputs) out.path += ".tmp_v.mp4";
+    }
 
     converter_log(LOG_INFO, "Requested resolution: %dx%d @ %g fps, CRF %d",
                   ff_config.width, ff_config.height, ff_config.fps, ff_config.crf);
@@ -379,10 +638,18 @@ bool convert_one(const std::string& krec_path, const std::string& output_path,
     if (s_cancel_flag) {
         frame_capture_set_cancel_flag(s_cancel_flag);
     }
+    frame_capture_set_worker_threads(config.capture_threads);
+    frame_capture_set_frame_limit(config.max_frames);
+    // The hash sidecar is staged and flushed along with the output
+    std::string hash_dest = output_path + ".framehash";
+    if (config.frame_hash) {
+        frame_capture_set_hash_output(stage_path(hash_dest));
+    }
     emu.set_frame_callback(frame_capture_callback);
 
     converter_log(LOG_INFO, "Running emulation (%d input frames)...", krec.total_input_frames);
     m64p_error ret = emu.execute();
+    if (live_audio) set_callback_fn(nullptr, nullptr);
 
     // Flush last PBO-buffered frame before closing encoder
     frame_capture_flush();
@@ -391,7 +658,11 @@ bool convert_one(const std::string& krec_path, const std::string& output_path,
     converter_log(LOG_INFO, "Emulation finished. Captured %d frames.", frames_captured);
 
     // Close encoder and emulator (this also closes audio capture file via RomClosed)
-    encoder.close();
+    bool encoder_ok = encoder.close();
+    log_pipeline_summary(frame_capture_stats(), encoder.stats());
+    for (const auto& err : encoder.stats().errors) {
+        converter_log(LOG_WARNING, "Warning: encoder failure: %s", err.c_str());
+    }
 
     // Get audio info before shutdown
     unsigned int audio_freq = 33600;
@@ -402,41 +673,148 @@ bool convert_one(const std::string& krec_path, const std::string& output_path,
     converter_log(LOG_INFO, "Audio capture: %llu bytes, frequency: %u Hz",
                   audio_bytes, audio_freq);
 
+    AudioHandoffResult handoff = finish_ring_audio();
     emu.shutdown();
+    if (ring_audio) {
+        audio_bytes = handoff.bytes;
+        // The encoded track's timing follows the rate it was encoded at
+        if (handoff.encoded_rate > 0) {
+            if (handoff.encoded_rate != audio_freq) {
+                converter_log(LOG_WARNING, "Warning: audio rate changed from %u to %u Hz during capture",
+                              handoff.encoded_rate, audio_freq);
+            }
+            audio_freq = handoff.encoded_rate;
+            if (!handoff.encoded) {
+                converter_log(LOG_ERROR, "Error: audio encode failed, keeping video-only output.");
+                audio_bytes = 0;
+            }
+        }
+    }
+
+    // Finished: hand staged files to the flusher and queue a lossless
+    // capture's encode (once it has reached its destination, when staged)
+    auto complete = [&]() -> bool {
+        double duration = frames_captured / fps;
+        if (!staged) {
+            if (!config.capture_lossless) return true;
+            return queue_transcode(encode_path, output_path, preset, encoder_threads, duration, config);
+        }
+        for (size_t i = 0; i < extra_outputs.size(); i++) {
+            output_flusher_submit(krec_path, extra_outputs[i].path, extra_dests[i]);
+        }
+        if (config.frame_hash) output_flusher_submit(krec_path, stage_path(hash_dest), hash_dest);
+        if (!config.capture_lossless) {
+            output_flusher_submit(krec_path, encode_path, final_path);
+            return true;
+        }
+        // Runs on a flusher thread after this job has returned, so it captures copies
+        output_flusher_submit(krec_path, encode_path, final_path, [=](bool ok) {
+            if (ok) queue_transcode(final_path, output_path, preset, encoder_threads, duration, config);
+        });
+        return true;
+    };
+
+    if (direct_output) {
+        if (live_audio) {
+            LiveAudioStats stats = live_audio_stats();
+            converter_log(LOG_INFO, "Live audio: %llu samples in, %llu out @ %u Hz "
+                          "(%llu padded, %llu dropped)",
+                          stats.samples_in, stats.samples_out, LIVE_AUDIO_RATE,
+                          stats.silence_inserted, stats.samples_dropped);
+            if (stats.write_failures > 0) {
+                converter_log(LOG_WARNING, "Warning: %llu live audio writes failed (%llu samples lost)",
+                              stats.write_failures, stats.samples_failed);
+            }
+        }
+
+        if (s_cancel_flag && s_cancel_flag->load()) {
+            converter_log(LOG_WARNING, "Conversion cancelled.");
+            if (!streaming) fs::remove(encode_path);
+            for (const auto& out : extra_outputs) fs::remove(out.path);
+            return false;
+        }
+        if (!encoder_ok) {
+            // Partial files are left in place: they may be all there is of the replay
+            converter_log(LOG_ERROR, "Error: the encoder could not finish %s", encode_path.c_str());
+            return false;
+        }
+        if (frames_captured <= 0) {
+            converter_log(LOG_WARNING, "Warning: no frames were captured");
+            if (!streaming) fs::remove(encode_path);
+            for (const auto& out : extra_outputs) fs::remove(out.path);
+            return false;
+        }
+        converter_log(LOG_INFO, "Output saved to: %s",
+                      segmented ? segment_file_pattern(encode_path).c_str() : encode_path.c_str());
+        if (target_bitrate > 0 && !streaming) check_target_size(encode_path, config.target_size_mb);
+        for (const auto& out : extra_outputs) {
+            converter_log(LOG_INFO, "Output saved to: %s", out.path.c_str());
+        }
+        return complete();
+    }
 
     if (s_cancel_flag && s_cancel_flag->load()) {
         converter_log(LOG_WARNING, "Conversion cancelled.");
         fs::remove(temp_video);
         fs::remove(temp_audio);
+        fs::remove(temp_audio_enc);
+        for (const auto& out : ff_config.extra_outputs) fs::remove(out.path);
         return false;
     }
 
+    if (!encoder_ok) {
+        converter_log(LOG_ERROR, "Error: the encoder could not finish %s", temp_video.c_str());
+        return false;
+    }
     if (frames_captured <= 0) {
         converter_log(LOG_WARNING, "Warning: no frames were captured");
         fs::remove(temp_video);
         fs::remove(temp_audio);
+        fs::remove(temp_audio_enc);
+        for (const auto& out : ff_config.extra_outputs) fs::remove(out.path);
         return false;
     }
 
-    // Mux video + audio into final output
+    // Mux video + audio into each final output
+    auto finish_output = [&](const std::string& video_path, const std::string& final_path,
+                             const std::string& audio_codec, const std::string& format) {
+        if (audio_bytes > 0) {
+            if (!mux_video_audio(config.ffmpeg_path, video_path,
+                                 handoff.encoded ? temp_audio_enc : temp_audio, handoff.encoded,
+                                 ring_audio && !handoff.encoded ? &handoff.pcm : nullptr, audio_freq,
+                                 audio_bytes, frames_captured, fps, audio_codec, format, final_path)) {
+                converter_log(LOG_ERROR, "Error: FFmpeg mux failed, keeping video-only output.");
+                fs::rename(video_path, final_path);
+            }
+        } else {
+            fs::rename(video_path, final_path);
+        }
+        fs::remove(video_path);
+        converter_log(LOG_INFO, "Output saved to: %s", final_path.c_str());
+    };
+
     if (audio_bytes > 0) {
         converter_log(LOG_INFO, "Muxing video + audio (sample rate: %u Hz)...", audio_freq);
         // Signal muxing phase to progress callback
         if (s_progress_callback) s_progress_callback(-1, 0);
-        if (!mux_video_audio(config.ffmpeg_path, temp_video, temp_audio, audio_freq,
-                             audio_bytes, frames_captured, fps, output_path)) {
-            converter_log(LOG_ERROR, "Error: FFmpeg mux failed, keeping video-only output.");
-            fs::rename(temp_video, output_path);
-        }
     } else {
         converter_log(LOG_INFO, "No audio captured, keeping video-only output.");
-        fs::rename(temp_video, output_path);
+    }
+    auto mux_start = std::chrono::steady_clock::now();
+    finish_output(temp_video, encode_path, ff_config.audio_codec, config.output_format);
+    if (target_bitrate > 0) check_target_size(encode_path, config.target_size_mb);
+    for (size_t i = 0; i < extra_outputs.size(); i++) {
+        finish_output(ff_config.extra_outputs[i].path, extra_outputs[i].path, "aac", "");
+    }
+    if (audio_bytes > 0) {
+        converter_log(LOG_INFO, "Mux took %.1f s%s",
+                      std::chrono::duration<double>(std::chrono::steady_clock::now() - mux_start).count(),
+                      handoff.encoded ? " (audio encoded during emulation, stream copy)" : "");
     }
 
     // Cleanup temp files
-    fs::remove(temp_video);
     fs::remove(temp_audio);
+    fs::remove(temp_audio_enc);
 
-    converter_log(LOG_INFO, "Output saved to: %s", output_path.c_str());
-    return true;
+    return complete();
 }
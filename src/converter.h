@@ -1,5 +1,7 @@
 #pragma once
+#include "ffmpeg_encoder.h"
 #include <string>
+#include <vector>
 #include <functional>
 #include <atomic>
 
@@ -27,7 +29,11 @@ void converter_log(int level, const char* fmt, ...);
 struct AppConfig {
     std::string rom_path;
     std::string input_path;   // .krec file or directory (batch)
-    std::string output_path;  // output file or directory
+    std::string output_path;  // output file or directory, "-" = stdout, "pipe:N" = fd
+    std::string output_format; // "" = by extension, "fmp4" or "mpegts", "hls" or "dash" (ladder package)
+    std::vector<LadderRung> ladder; // hls/dash renditions, empty = one at the render size
+    double segment_minutes = 0; // >0: roll the output into <stem>_NNN segments this long
+    bool segment_markers = false; // also start a new segment at chat/drop events
     std::string core_path;    // resolved in main()
     std::string plugin_dir;
     std::string data_dir;
@@ -35,12 +41,37 @@ struct AppConfig {
     double fps = 0; // 0 = auto-detect
     int res_width = 640;
     int res_height = 480;
+    std::string native_render; // "neighbor"/"lanczos": render at 320x240 and upscale to res in the encoder
     int crf = 23;
+    double target_size_mb = 0; // >0: pick the bitrate that fits this size (10^6 bytes) instead of crf
     int msaa = 0;       // 0=off, 2, 4, 8, 16
     int aniso = 0;      // 0=off, 2, 4, 8, 16
     std::string encoder = "libx264"; // FFmpeg codec name
+    std::string preset;      // encoder speed preset, "" = per-encoder default
+    int encoder_threads = 0; // CPU encoder threads, 0 = encoder default
+    bool auto_tune = false;  // pick preset/threads by trial encodes (cached per game)
+    double tune_min_ssim = 0.98; // auto-tune quality bar
+    EncoderBackend backend = EncoderBackend::Pipe;
+    std::string audio_output; // y4m backend: audio sink (.wav or raw s16le), "" = <output>.wav
     bool batch = false;
     bool verbose = false;
+    bool live_audio = true;  // single-pass A/V encode when the audio plugin supports it
+    int capture_threads = 0; // flip worker threads, 0 = auto by resolution
+    bool batch_writes = true; // pipe backend: coalesce small frames into fewer pipe writes
+    bool recover = false;    // replace a crashed ffmpeg and continue in a new segment (.mp4 as fMP4)
+    bool frame_hash = false; // write <output>.framehash sidecar
+    bool capture_audio = true; // false = video only, written straight to the output
+    int max_frames = 0;      // stop after this many frames, 0 = whole replay
+    bool capture_lossless = false;        // write a lossless .capture.mkv and queue the encode
+    std::string lossless_codec = "utvideo"; // "utvideo" or "ffv1"
+    std::string queue_dir;   // transcode queue, "" = next to the output
+    std::string scratch_dir; // stage single-file outputs and intermediates here, "" = write in place
+    int flush_jobs = 2;      // concurrent background moves from scratch_dir to the destination
+    int encode_workers = 0;  // >1: parallel chunked encode in this many ffmpeg processes
+    int chunk_frames = 0;    // frames per chunk, 0 = auto
+    std::vector<FFmpegOutput> extra_outputs; // same-pass extra files; "{stem}" = input name
+    std::string transcode_queue; // worker mode: process jobs in this queue instead of converting
+    bool queue_watch = false;    // worker mode: keep polling when the queue is empty
 };
 
 // Get the directory containing the executable
@@ -50,7 +81,8 @@ std::string get_exe_dir();
 bool check_ffmpeg(const std::string& ffmpeg_path);
 
 // Generate output path from input path (replaces .krec with .mp4)
-std::string make_output_path(const std::string& input_path, const std::string& output_path);
+std::string make_output_path(const std::string& input_path, const std::string& output_path,
+                             const std::string& format = "");
 
 // Convert a single .krec file to .mp4. Returns true on success.
 bool convert_one(const std::string& krec_path, const std::string& output_path,
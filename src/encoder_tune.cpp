@@ -0,0 +1,256 @@
+#include "encoder_tune.h"
+#include "frame_capture.h"
+#include "subprocess.h"
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Reference capture: skip the boot/menu part of the replay and trial-encode
+// the frames after it.
+static const int TUNE_SKIP_FRAMES = 1200;
+static const int TUNE_TRIAL_FRAMES = 600;
+
+// A thread count is kept if it reaches this fraction of the preset's best speed;
+// fewer encoder threads leave more cores to emulation and capture.
+static const double TUNE_THREAD_SPEED_KEEP = 0.95;
+
+static std::string cache_path() {
+    return get_exe_dir() + "encoder_tune.cache";
+}
+
+static std::string cache_key(const std::string& game_name, const AppConfig& config) {
+    std::string game = game_name;
+    for (char& c : game) {
+        if (c == '\t' || c == '\n' || c == '\r') c = ' ';
+    }
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%s\t%dx%d\t%s\t%d\t%.4f", game.c_str(),
+             config.res_width, config.res_height, config.encoder.c_str(),
+             config.crf, config.tune_min_ssim);
+    return buf;
+}
+
+// Cache format: one tab-separated line per key, "<key>\t<preset>\t<threads>\t<fps>\t<ssim>".
+// Later lines override earlier ones.
+static bool load_cached(const std::string& key, EncoderTuneResult& out) {
+    FILE* f = fopen(cache_path().c_str(), "r");
+    if (!f) return false;
+
+    bool found = false;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, key.c_str(), key.size()) != 0 || line[key.size()] != '\t') continue;
+        char preset[64];
+        int threads = 0;
+        double fps = 0, ssim = 0;
+        if (sscanf(line + key.size() + 1, "%63s %d %lf %lf", preset, &threads, &fps, &ssim) == 4) {
+            out.preset = preset;
+            out.threads = threads;
+            out.fps = fps;
+            out.ssim = ssim;
+            found = true;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+static void store_cached(const std::string& key, const EncoderTuneResult& result) {
+    FILE* f = fopen(cache_path().c_str(), "a");
+    if (!f) {
+        converter_log(LOG_WARNING, "Warning: cannot write auto-tune cache '%s'", cache_path().c_str());
+        return;
+    }
+    fprintf(f, "%s\t%s\t%d\t%.1f\t%.5f\n", key.c_str(), result.preset.c_str(),
+            result.threads, result.fps, result.ssim);
+    fclose(f);
+}
+
+struct TrialInput {
+    std::string ffmpeg_path;
+    std::string reference;
+    double seek = 0;   // seconds into the reference
+    int frames = 0;
+};
+
+// Encode the trial frames with one setting. Returns encode fps, or 0 on failure.
+static double run_trial(const TrialInput& in, const FFmpegConfig& ff, const std::string& out_path) {
+    char head[1024];
+    snprintf(head, sizeof(head), "\"%s\" -hide_banner -y -ss %.3f -i \"%s\" -frames:v %d -an ",
+             in.ffmpeg_path.c_str(), in.seek, in.reference.c_str(), in.frames);
+    std::string cmd = head + ffmpeg_encoder_flags(ff) + " \"" + out_path + "\"";
+    converter_log(LOG_VERBOSE, "Tune cmd: %s", cmd.c_str());
+
+    // Progress lines are \r-separated; the last "frame=" on the final line is the total
+    int frames = 0;
+    auto start = std::chrono::steady_clock::now();
+    int exit_code = run_process(cmd, [&frames](const char* line) {
+        const char* p = nullptr;
+        for (const char* s = strstr(line, "frame="); s; s = strstr(s + 1, "frame=")) p = s;
+        if (p) sscanf(p + 6, "%d", &frames);
+        converter_log(LOG_VERBOSE, "[FFmpeg tune] %s", line);
+    });
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (exit_code != 0 || frames <= 0 || secs <= 0) return 0;
+    return frames / secs;
+}
+
+// SSIM of a trial encode against the same frames of the reference (0 on failure).
+static double measure_ssim(const TrialInput& in, const std::string& trial_path) {
+    char cmd[2048];
+    snprintf(cmd, sizeof(cmd),
+        "\"%s\" -hide_banner -nostats -i \"%s\" -ss %.3f -i \"%s\" -frames:v %d "
+        "-lavfi \"[0:v][1:v]ssim\" -f null -",
+        in.ffmpeg_path.c_str(), trial_path.c_str(), in.seek, in.reference.c_str(), in.frames);
+
+    double ssim = 0;
+    run_process(cmd, [&ssim](const char* line) {
+        const char* all = strstr(line, "All:");
+        if (strstr(line, "SSIM") && all) sscanf(all + 4, "%lf", &ssim);
+    });
+    return ssim;
+}
+
+bool encoder_auto_tune(const std::string& krec_path, const std::string& game_name,
+                       const AppConfig& config, EncoderTuneResult& out) {
+    std::string key = cache_key(game_name, config);
+    if (load_cached(key, out)) {
+        converter_log(LOG_INFO, "Auto-tune: cached %s preset %s, threads %d (%.0f fps, SSIM %.4f)",
+                      config.encoder.c_str(), out.preset.c_str(), out.threads, out.fps, out.ssim);
+        return true;
+    }
+
+    std::vector<std::string> presets = encoder_speed_presets(config.encoder);
+    if (presets.empty()) {
+        converter_log(LOG_WARNING, "Warning: auto-tune does not support encoder '%s'",
+                      config.encoder.c_str());
+        return false;
+    }
+
+    // 1. Capture a lossless reference sample of the replay
+    fs::path temp_dir = fs::temp_directory_path();
+#ifdef _WIN32
+    std::string tag = "krec2mp4_tune_" + std::to_string(GetCurrentProcessId());
+#else
+    std::string tag = "krec2mp4_tune_" + std::to_string(getpid());
+#endif
+    std::string reference = (temp_dir / (tag + "_ref.mkv")).string();
+    std::string trial_path = (temp_dir / (tag + "_trial.mp4")).string();
+
+    // Only what the capture itself needs; every output option stays at its default
+    AppConfig sample;
+    sample.rom_path = config.rom_path;
+    sample.core_path = config.core_path;
+    sample.plugin_dir = config.plugin_dir;
+    sample.data_dir = config.data_dir;
+    sample.ffmpeg_path = config.ffmpeg_path;
+    sample.fps = config.fps;
+    sample.res_width = config.res_width;
+    sample.res_height = config.res_height;
+    sample.msaa = config.msaa;
+    sample.aniso = config.aniso;
+    sample.verbose = config.verbose;
+    sample.encoder = "ffv1";
+    sample.capture_audio = false;
+    sample.max_frames = TUNE_SKIP_FRAMES + TUNE_TRIAL_FRAMES;
+
+    converter_log(LOG_INFO, "Auto-tune: capturing %d-frame reference sample...", sample.max_frames);
+    if (!convert_one(krec_path, reference, sample)) {
+        fs::remove(reference);
+        return false;
+    }
+
+    double fps = config.fps > 0 ? config.fps : 60.0;
+    int captured = frame_capture_count();
+    TrialInput in;
+    in.ffmpeg_path = config.ffmpeg_path;
+    in.reference = reference;
+    in.frames = captured < TUNE_TRIAL_FRAMES ? captured : TUNE_TRIAL_FRAMES;
+    in.seek = (captured - in.frames) / fps;
+
+    FFmpegConfig ff;
+    ff.encoder = config.encoder;
+    ff.crf = config.crf;
+
+    // 2. Presets are ordered fastest first, so the first one that meets the
+    //    quality bar is the fastest acceptable one. If none does, keep the best.
+    bool found = false;
+    EncoderTuneResult best;
+    for (const std::string& preset : presets) {
+        ff.preset = preset;
+        ff.threads = 0;
+        double trial_fps = run_trial(in, ff, trial_path);
+        double ssim = trial_fps > 0 ? measure_ssim(in, trial_path) : 0;
+        converter_log(LOG_INFO, "Auto-tune: %s %-10s %7.1f fps  SSIM %.4f",
+                      config.encoder.c_str(), preset.c_str(), trial_fps, ssim);
+        if (trial_fps <= 0) continue;
+
+        if (ssim > best.ssim) {
+            best.preset = preset;
+            best.fps = trial_fps;
+            best.ssim = ssim;
+        }
+        if (ssim >= config.tune_min_ssim) {
+            best.preset = preset;
+            best.fps = trial_fps;
+            best.ssim = ssim;
+            found = true;
+            break;
+        }
+    }
+
+    if (best.preset.empty()) {
+        converter_log(LOG_WARNING, "Warning: auto-tune trial encodes failed, using defaults");
+        fs::remove(reference);
+        fs::remove(trial_path);
+        return false;
+    }
+    if (!found) {
+        converter_log(LOG_WARNING, "Warning: no %s preset reached SSIM %.4f, using the best (%s)",
+                      config.encoder.c_str(), config.tune_min_ssim, best.preset.c_str());
+    }
+
+    // 3. CPU encoders: try fewer threads at the chosen preset
+    const EncoderInfo* info = find_encoder_info(config.encoder);
+    if (info && (info->family == EncoderFamily::X264_X265 || info->family == EncoderFamily::SVT_AV1 ||
+                 info->family == EncoderFamily::VP9)) {
+        int cores = (int)std::thread::hardware_concurrency();
+        std::vector<int> counts;
+        for (int n : { cores / 4, cores / 2 }) {
+            if (n >= 2 && (counts.empty() || counts.back() != n)) counts.push_back(n);
+        }
+        ff.preset = best.preset;
+        for (int n : counts) {
+            ff.threads = n;
+            double trial_fps = run_trial(in, ff, trial_path);
+            converter_log(LOG_INFO, "Auto-tune: %s %-10s %7.1f fps  (%d threads)",
+                          config.encoder.c_str(), best.preset.c_str(), trial_fps, n);
+            if (trial_fps >= best.fps * TUNE_THREAD_SPEED_KEEP) {
+                best.threads = n;
+                break;
+            }
+        }
+    }
+
+    fs::remove(reference);
+    fs::remove(trial_path);
+
+    converter_log(LOG_INFO, "Auto-tune: using %s preset %s, threads %d (%.0f fps, SSIM %.4f)",
+                  config.encoder.c_str(), best.preset.c_str(), best.threads, best.fps, best.ssim);
+    store_cached(key, best);
+    out = best;
+    return true;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "converter.h"
+#include <string>
+
+struct EncoderTuneResult {
+    std::string preset;
+    int threads = 0;   // 0 = encoder default
+    double fps = 0;    // trial encode speed
+    double ssim = 0;   // trial quality vs. the lossless reference
+};
+
+// Pick the fastest speed preset (and the fewest threads that keep its speed)
+// for config.encoder that stays at or above config.tune_min_ssim on a sample
+// of the replay. Results are cached per game, resolution, encoder and CRF in
+// <exe_dir>/encoder_tune.cache. Returns false if no choice could be made.
+bool encoder_auto_tune(const std::string& krec_path, const std::string& game_name,
+                       const AppConfig& config, EncoderTuneResult& out);
@@ -1,7 +1,16 @@
 #include "ffmpeg_encoder.h"
+#include "libav_encoder.h"
+#include "chunk_encoder.h"
+#include "y4m_writer.h"
+#include "subprocess.h"
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <string>
+#include <thread>
+#include <filesystem>
 
 // Quality presets for 0-51 range encoders (X264_X265, AMF, NVENC)
 static const QualityPreset g_presets_51[] = {
@@ -21,12 +30,25 @@ static const QualityPreset g_presets_255[] = {
     { "Lowest", 180 },
 };
 
+// Quality presets for 0-63 range encoders (SVT_AV1, VP9). Chosen to land
+// near the same visual quality as the 0-51 scale at each step; 0 is not
+// lossless for these encoders, so Highest stops short of it.
+static const QualityPreset g_presets_63[] = {
+    { "Highest", 10 },
+    { "High",    24 },
+    { "Medium",  32 },
+    { "Low",     40 },
+    { "Lowest",  50 },
+};
+
 static const QualityFamily g_quality_families[] = {
     { EncoderFamily::X264_X265, "CRF", g_presets_51,  5, 2 },
     { EncoderFamily::AMF,       "QP",  g_presets_51,  5, 2 },
     { EncoderFamily::AMF_AV1,   "QP",  g_presets_255, 5, 2 },
     { EncoderFamily::NVENC,     "CQ",  g_presets_51,  5, 2 },
     { EncoderFamily::NVENC_AV1, "CQ",  g_presets_255, 5, 2 },
+    { EncoderFamily::SVT_AV1,   "CRF", g_presets_63,  5, 2 },
+    { EncoderFamily::VP9,       "CRF", g_presets_63,  5, 2 },
 };
 
 const QualityFamily& get_quality_family(EncoderFamily family) {
@@ -40,6 +62,8 @@ const QualityFamily& get_quality_family(EncoderFamily family) {
 static const EncoderInfo g_all_encoders[] = {
     { L"H.264 (CPU)",        "libx264",    false, EncoderFamily::X264_X265 },
     { L"H.265 (CPU)",        "libx265",    false, EncoderFamily::X264_X265 },
+    { L"AV1 (CPU, SVT-AV1)", "libsvtav1",  true,  EncoderFamily::SVT_AV1 },
+    { L"VP9 (CPU)",          "libvpx-vp9", true,  EncoderFamily::VP9 },
     { L"H.264 (AMD GPU)",    "h264_amf",   true,  EncoderFamily::AMF },
     { L"H.265 (AMD GPU)",    "hevc_amf",   true,  EncoderFamily::AMF },
     { L"AV1 (AMD GPU)",      "av1_amf",    true,  EncoderFamily::AMF_AV1 },
@@ -48,7 +72,17 @@ static const EncoderInfo g_all_encoders[] = {
     { L"AV1 (NVIDIA GPU)",   "av1_nvenc",  true,  EncoderFamily::NVENC_AV1 },
 };
 
+const EncoderInfo* find_encoder_info(const std::string& codec) {
+    for (const auto& enc : g_all_encoders) {
+        if (codec == enc.codec) return &enc;
+    }
+    return nullptr;
+}
+
 #ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX  // the ladder bitrates use std::max
+#endif
 #include <windows.h>
 
 // Test if a hardware encoder works by running a minimal FFmpeg encode
@@ -81,146 +115,691 @@ static bool probe_encoder(const std::string& ffmpeg_path, const char* codec) {
 
 #else
 
+// popen-based (run_process) rather than system(), which is not safe to call
+// from several probe threads at once
 static bool probe_encoder(const std::string& ffmpeg_path, const char* codec) {
     char cmd[512];
     snprintf(cmd, sizeof(cmd),
-        "\"%s\" -v quiet -f lavfi -i nullsrc=s=16x16:d=0.01 -frames:v 1 -c:v %s -f null - 2>/dev/null",
+        "\"%s\" -v quiet -f lavfi -i color=black:s=256x256:d=0.1 -frames:v 1 -c:v %s -f null -",
         ffmpeg_path.c_str(), codec);
-    return system(cmd) == 0;
+    return run_process(cmd, nullptr) == 0;
 }
 
 #endif
 
-std::vector<EncoderInfo> probe_available_encoders(const std::string& ffmpeg_path) {
-    std::vector<EncoderInfo> available;
-    for (const auto& enc : g_all_encoders) {
-        if (!enc.hw) {
-            available.push_back(enc);
-        } else if (probe_encoder(ffmpeg_path, enc.codec)) {
-            available.push_back(enc);
+// Identity of the ffmpeg binary for the probe cache: "<path>\t<size>\t<mtime>".
+// Empty if the binary can't be stat'ed (e.g. a bare "ffmpeg" found via PATH).
+static std::string probe_cache_stamp(const std::string& ffmpeg_path) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(ffmpeg_path, ec);
+    if (ec) return "";
+    auto mtime = std::filesystem::last_write_time(ffmpeg_path, ec);
+    if (ec) return "";
+    return ffmpeg_path + "\t" + std::to_string((unsigned long long)size) + "\t" +
+           std::to_string((long long)mtime.time_since_epoch().count());
+}
+
+// Cache format: the stamp line, then one "<codec>\t<0|1>" line per hardware encoder.
+static bool load_probe_cache(const std::string& cache_path, const std::string& stamp,
+                             std::vector<char>& results) {
+    FILE* f = fopen(cache_path.c_str(), "r");
+    if (!f) return false;
+
+    char line[1024];
+    bool valid = fgets(line, sizeof(line), f) &&
+                 std::string(line, strcspn(line, "\r\n")) == stamp;
+    int matched = 0;
+    while (valid && fgets(line, sizeof(line), f)) {
+        char codec[64];
+        int ok = 0;
+        if (sscanf(line, "%63s %d", codec, &ok) != 2) continue;
+        for (size_t i = 0; i < results.size(); i++) {
+            if (strcmp(g_all_encoders[i].codec, codec) == 0 && g_all_encoders[i].hw) {
+                results[i] = ok ? 1 : 0;
+                matched++;
+            }
         }
     }
-    return available;
+    fclose(f);
+
+    int hw_count = 0;
+    for (const auto& enc : g_all_encoders) hw_count += enc.hw ? 1 : 0;
+    return valid && matched == hw_count;
 }
 
-// Build encoder-specific quality/preset flags for FFmpeg
-static std::string build_encoder_flags(const std::string& encoder, int crf) {
-    if (encoder == "libx264") {
-        char buf[128];
-        snprintf(buf, sizeof(buf), "-c:v libx264 -preset medium -crf %d -pix_fmt yuv420p", crf);
-        return buf;
+static void store_probe_cache(const std::string& cache_path, const std::string& stamp,
+                              const std::vector<char>& results) {
+    FILE* f = fopen(cache_path.c_str(), "w");
+    if (!f) return;
+    fprintf(f, "%s\n", stamp.c_str());
+    for (size_t i = 0; i < results.size(); i++) {
+        if (g_all_encoders[i].hw) fprintf(f, "%s\t%d\n", g_all_encoders[i].codec, results[i] ? 1 : 0);
     }
-    if (encoder == "libx265") {
-        char buf[128];
-        snprintf(buf, sizeof(buf), "-c:v libx265 -preset medium -crf %d -pix_fmt yuv420p", crf);
-        return buf;
+    fclose(f);
+}
+
+std::vector<EncoderInfo> probe_available_encoders(const std::string& ffmpeg_path,
+                                                  const std::string& cache_path) {
+    const size_t count = sizeof(g_all_encoders) / sizeof(g_all_encoders[0]);
+    std::vector<char> results(count, 0);
+
+    std::string stamp = cache_path.empty() ? "" : probe_cache_stamp(ffmpeg_path);
+    if (stamp.empty() || !load_probe_cache(cache_path, stamp, results)) {
+        // Each probe is a separate ffmpeg process; run them all at once so the
+        // total wait is the slowest probe rather than the sum.
+        std::vector<std::thread> probes;
+        for (size_t i = 0; i < count; i++) {
+            if (!g_all_encoders[i].hw) continue;
+            probes.emplace_back([&results, &ffmpeg_path, i] {
+                results[i] = probe_encoder(ffmpeg_path, g_all_encoders[i].codec) ? 1 : 0;
+            });
+        }
+        for (auto& t : probes) t.join();
+        if (!stamp.empty()) store_probe_cache(cache_path, stamp, results);
     }
-    if (encoder == "h264_amf") {
-        char buf[128];
-        snprintf(buf, sizeof(buf), "-c:v h264_amf -quality quality -rc cqp -qp_i %d -qp_p %d -pix_fmt yuv420p", crf, crf);
-        return buf;
+
+    std::vector<EncoderInfo> available;
+    for (size_t i = 0; i < count; i++) {
+        if (!g_all_encoders[i].hw || results[i]) available.push_back(g_all_encoders[i]);
     }
-    if (encoder == "hevc_amf") {
-        char buf[128];
-        snprintf(buf, sizeof(buf), "-c:v hevc_amf -quality quality -rc cqp -qp_i %d -qp_p %d -pix_fmt yuv420p", crf, crf);
-        return buf;
+    return available;
+}
+
+// Build encoder-specific quality/preset flags for FFmpeg. bitrate (kbps) > 0
+// switches from constant quality to average-bitrate rate control with
+// lookahead, for size-targeted encodes.
+static std::string build_encoder_flags(const std::string& encoder, int crf,
+                                       const std::string& preset, int threads, int bitrate) {
+    char buf[256];
+    char rc[160];
+    if (encoder == "libx264" || encoder == "libx265") {
+        bool x265 = encoder == "libx265";
+        if (bitrate > 0) {
+            snprintf(rc, sizeof(rc), x265 ? "-b:v %dk -maxrate %dk -bufsize %dk"
+                                          : "-b:v %dk -maxrate %dk -bufsize %dk -rc-lookahead 60",
+                     bitrate, bitrate * 3 / 2, bitrate * 2);
+        } else {
+            snprintf(rc, sizeof(rc), "-crf %d", crf);
+        }
+        snprintf(buf, sizeof(buf), "-c:v %s -preset %s %s -pix_fmt yuv420p",
+                 encoder.c_str(), preset.empty() ? "medium" : preset.c_str(), rc);
+        std::string flags = buf;
+
+        // libx265 ignores -threads and -rc-lookahead; both go through x265-params
+        std::string x265_params;
+        if (threads > 0) {
+            if (x265) x265_params = "pools=" + std::to_string(threads);
+            else flags += " -threads " + std::to_string(threads);
+        }
+        if (x265 && bitrate > 0) {
+            x265_params += (x265_params.empty() ? "" : ":") + std::string("rc-lookahead=60");
+        }
+        if (!x265_params.empty()) flags += " -x265-params " + x265_params;
+        return flags;
     }
-    if (encoder == "av1_amf") {
-        char buf[128];
-        snprintf(buf, sizeof(buf), "-c:v av1_amf -quality quality -rc cqp -qp_i %d -qp_p %d -pix_fmt yuv420p", crf, crf);
+    if (encoder == "h264_amf" || encoder == "hevc_amf" || encoder == "av1_amf") {
+        if (bitrate > 0) {
+            snprintf(rc, sizeof(rc), "-rc vbr_peak -b:v %dk -maxrate %dk -preanalysis 1",
+                     bitrate, bitrate * 3 / 2);
+        } else {
+            snprintf(rc, sizeof(rc), "-rc cqp -qp_i %d -qp_p %d", crf, crf);
+        }
+        snprintf(buf, sizeof(buf), "-c:v %s -quality %s %s -pix_fmt yuv420p",
+                 encoder.c_str(), preset.empty() ? "quality" : preset.c_str(), rc);
         return buf;
     }
-    if (encoder == "h264_nvenc") {
-        char buf[128];
-        snprintf(buf, sizeof(buf), "-c:v h264_nvenc -preset p7 -rc vbr -cq %d -pix_fmt yuv420p", crf);
+    if (encoder == "h264_nvenc" || encoder == "hevc_nvenc" || encoder == "av1_nvenc") {
+        if (bitrate > 0) {
+            snprintf(rc, sizeof(rc), "-rc vbr -b:v %dk -maxrate %dk -bufsize %dk -rc-lookahead 32",
+                     bitrate, bitrate * 3 / 2, bitrate * 2);
+        } else {
+            snprintf(rc, sizeof(rc), "-rc vbr -cq %d", crf);
+        }
+        snprintf(buf, sizeof(buf), "-c:v %s -preset %s %s -pix_fmt yuv420p",
+                 encoder.c_str(), preset.empty() ? "p7" : preset.c_str(), rc);
         return buf;
     }
-    if (encoder == "hevc_nvenc") {
-        char buf[128];
-        snprintf(buf, sizeof(buf), "-c:v hevc_nvenc -preset p7 -rc vbr -cq %d -pix_fmt yuv420p", crf);
+    if (encoder == "libsvtav1") {
+        // Preset 8 is SVT-AV1's realtime-ish throughput point; 2 tile columns
+        // and a 5 s GOP keep its frame-parallel pipeline busy at 480p-1080p.
+        if (bitrate > 0) snprintf(rc, sizeof(rc), "-b:v %dk", bitrate);
+        else snprintf(rc, sizeof(rc), "-crf %d", crf);
+        snprintf(buf, sizeof(buf),
+                 "-c:v libsvtav1 -preset %s %s -g 300 -svtav1-params tile-columns=1%s -pix_fmt yuv420p",
+                 preset.empty() ? "8" : preset.c_str(), rc,
+                 threads > 0 ? (":lp=" + std::to_string(threads)).c_str() : "");
         return buf;
     }
-    if (encoder == "av1_nvenc") {
-        char buf[128];
-        snprintf(buf, sizeof(buf), "-c:v av1_nvenc -preset p7 -rc vbr -cq %d -pix_fmt yuv420p", crf);
-        return buf;
+    if (encoder == "libvpx-vp9") {
+        // Constant-quality mode needs -b:v 0; row-mt and tile columns are what
+        // let libvpx use more than a couple of cores.
+        if (bitrate > 0) snprintf(rc, sizeof(rc), "-b:v %dk -lag-in-frames 25", bitrate);
+        else snprintf(rc, sizeof(rc), "-crf %d -b:v 0", crf);
+        std::string flags = "-c:v libvpx-vp9 -deadline good -cpu-used " +
+                            (preset.empty() ? std::string("4") : preset) + " " + rc +
+                            " -g 300 -row-mt 1 -tile-columns 2 -frame-parallel 0 -pix_fmt yuv420p";
+        if (threads > 0) flags += " -threads " + std::to_string(threads);
+        return flags;
+    }
+    if (encoder == "ffv1") {
+        // Lossless intra-only RGB; used for reference captures
+        return "-c:v ffv1 -level 3 -g 1 -slices 4 -pix_fmt bgr0";
+    }
+    if (encoder == "utvideo") {
+        // Lossless intra-only RGB, several times cheaper than FFV1 to encode
+        return "-c:v utvideo -pred left -pix_fmt gbrp";
     }
     // Fallback: treat as libx264
+    return build_encoder_flags("libx264", crf, preset, threads, bitrate);
+}
+
+std::vector<std::string> encoder_speed_presets(const std::string& encoder) {
+    if (encoder == "libx264" || encoder == "libx265") {
+        return { "ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow" };
+    }
+    if (encoder == "libsvtav1") {
+        return { "12", "10", "8", "6", "4" };
+    }
+    if (encoder == "libvpx-vp9") {
+        return { "5", "4", "3", "2", "1" };
+    }
+    if (encoder == "h264_amf" || encoder == "hevc_amf" || encoder == "av1_amf") {
+        return { "speed", "balanced", "quality" };
+    }
+    if (encoder == "h264_nvenc" || encoder == "hevc_nvenc" || encoder == "av1_nvenc") {
+        return { "p1", "p2", "p3", "p4", "p5", "p6", "p7" };
+    }
+    return {};
+}
+
+std::string ffmpeg_encoder_flags(const FFmpegConfig& config) {
+    return build_encoder_flags(config.encoder, config.crf, config.preset, config.threads,
+                               config.bitrate_kbps);
+}
+
+bool encoder_supports_two_pass(const std::string& encoder) {
+    return encoder == "libx264" || encoder == "libvpx-vp9";
+}
+
+int target_video_bitrate_kbps(double size_mb, double duration_seconds, int audio_kbps) {
+    if (size_mb <= 0 || duration_seconds <= 0) return 0;
+    // MB = 10^6 bytes (the smaller reading of upload limits), less ~2% for
+    // container overhead
+    double total_kbps = size_mb * 1e6 * 8.0 / 1000.0 / duration_seconds * 0.98;
+    int video_kbps = (int)(total_kbps - audio_kbps);
+    return video_kbps < MIN_TARGET_VIDEO_KBPS ? MIN_TARGET_VIDEO_KBPS : video_kbps;
+}
+
+std::string ffmpeg_audio_flags(const std::string& audio_codec) {
+    if (audio_codec == "pcm_s16le") return "-c:a pcm_s16le";
+    return "-c:a aac -b:a " + std::to_string(AUDIO_BITRATE_KBPS) + "k";
+}
+
+bool parse_output_spec(const std::string& spec, FFmpegOutput& out) {
+    out = FFmpegOutput();
+    size_t pos = spec.find(',');
+    out.path = spec.substr(0, pos);
+    if (out.path.empty()) return false;
+
+    while (pos != std::string::npos) {
+        size_t start = pos + 1;
+        pos = spec.find(',', start);
+        std::string item = spec.substr(start, pos == std::string::npos ? std::string::npos : pos - start);
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = item.substr(0, eq);
+        std::string value = item.substr(eq + 1);
+
+        if (key == "encoder") {
+            out.encoder = value;
+        } else if (key == "crf") {
+            out.crf = atoi(value.c_str());
+        } else if (key == "preset") {
+            out.preset = value;
+        } else if (key == "height") {
+            out.height = atoi(value.c_str());
+            if (out.height <= 0) return false;
+        } else if (key == "res") {
+            if (sscanf(value.c_str(), "%dx%d", &out.width, &out.height) != 2 ||
+                out.width <= 0 || out.height <= 0) return false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parse_ladder_spec(const std::string& spec, std::vector<LadderRung>& out) {
+    out.clear();
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        std::string item = spec.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        LadderRung rung;
+        int fields = sscanf(item.c_str(), "%d:%d", &rung.height, &rung.bitrate_kbps);
+        if (fields < 1 || rung.height <= 0 || (fields == 2 && rung.bitrate_kbps <= 0)) return false;
+        out.push_back(rung);
+        if (end == std::string::npos) break;
+        start = end + 1;
+    }
+    return !out.empty();
+}
+
+bool parse_encoder_backend(const std::string& name, EncoderBackend& out) {
+    if (name == "pipe") { out = EncoderBackend::Pipe; return true; }
+    if (name == "libav") { out = EncoderBackend::Libav; return true; }
+    if (name == "y4m") { out = EncoderBackend::Y4M; return true; }
+    return false;
+}
+
+bool is_stream_output(const std::string& output_path) {
+    return output_path == "-" || output_path.compare(0, 5, "pipe:") == 0;
+}
+
+// Original stdout, saved by ffmpeg_reserve_stdout() for "-" outputs
+#ifdef _WIN32
+static void* s_stream_handle = nullptr;
+#else
+static int s_stream_fd = -1;
+#endif
+
+bool is_package_format(const std::string& format) {
+    return format == "hls" || format == "dash";
+}
+
+std::string ffmpeg_format_args(const std::string& format) {
+    if (format == "fmp4") return "-f mp4 -movflags +frag_keyframe+empty_moov+default_base_moof ";
+    if (format == "mpegts") return "-f mpegts ";
+    return "";
+}
+
+const char* output_extension(const std::string& format) {
+    if (format == "hls") return ".m3u8";
+    if (format == "dash") return ".mpd";
+    if (format == "y4m") return ".y4m";
+    return ".mp4";
+}
+
+std::string segment_file_pattern(const std::string& output_path) {
+    std::filesystem::path p(output_path);
+    std::string ext = p.has_extension() ? p.extension().string() : ".mp4";
+    return (p.parent_path() / (p.stem().string() + "_%03d" + ext)).string();
+}
+
+std::string segment_index_path(const std::string& output_path) {
+    std::filesystem::path p(output_path);
+    return (p.parent_path() / (p.stem().string() + ".segments.csv")).string();
+}
+
+// Segment muxer arguments. Each segment file is closed as soon as the next
+// split point is reached, so it can be picked up while the capture goes on.
+// Keyframes are forced at the split points and timestamps restart per file,
+// so every segment plays on its own; the CSV index gets one
+// "file,start,end" line per finished segment.
+static std::string build_segment_args(const FFmpegConfig& config) {
+    char buf[32];
+    std::string times;
+    for (double t : config.segment_times) {
+        snprintf(buf, sizeof(buf), "%s%.3f", times.empty() ? "" : ",", t);
+        times += buf;
+    }
+
+    std::string args;
+    if (times.empty()) {
+        // Nothing to split: still one segment + index, so the layout is the same
+        args = "-f segment -segment_time 86400 ";
+    } else {
+        args = "-force_key_frames " + times + " -f segment -segment_times " + times + " ";
+    }
+    args += "-reset_timestamps 1 -segment_list_type csv -segment_list \"" +
+            segment_index_path(config.output_path) + "\" \"" +
+            segment_file_pattern(config.output_path) + "\"";
+    return args;
+}
+
+// Quote a path for a concat demuxer list entry
+static std::string concat_entry(const std::string& path) {
+    std::string quoted = "file '";
+    for (char c : path) {
+        if (c == '\'') quoted += "'\\''";
+        else quoted += c;
+    }
+    return quoted + "'";
+}
+
+bool ffmpeg_concat_files(const std::string& ffmpeg_path, const std::vector<std::string>& inputs,
+                         const std::string& output_path) {
+    std::string list_path = output_path + ".concat.txt";
+    FILE* list = fopen(list_path.c_str(), "w");
+    if (!list) {
+        fprintf(stderr, "Error: cannot write '%s'\n", list_path.c_str());
+        return false;
+    }
+    for (const auto& path : inputs) {
+        fprintf(list, "%s\n", concat_entry(std::filesystem::absolute(path).string()).c_str());
+    }
+    fclose(list);
+
+    std::string cmd = "\"" + ffmpeg_path + "\" -hide_banner -nostats -y "
+                      "-f concat -safe 0 -i \"" + list_path + "\" -c copy \"" + output_path + "\"";
+    std::string last_line;
+    int exit_code = run_process(cmd, [&last_line](const char* line) { last_line = line; });
+    remove(list_path.c_str());
+    if (exit_code != 0) {
+        fprintf(stderr, "Error: concat failed (%d): %s\n", exit_code, last_line.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Output target and muxer flags. Streams default to fragmented MP4 so the
+// moov atom is not needed up front and the output is playable as it arrives.
+static std::string build_output_args(const FFmpegConfig& config) {
+    if (config.segmented) return build_segment_args(config);
+
+    std::string format = config.output_format;
+    if (format.empty() && is_stream_output(config.output_path)) format = "fmp4";
+
+    std::string args = ffmpeg_format_args(format);
+    if (config.output_path == "-") {
+#ifdef _WIN32
+        args += "pipe:1";  // child stdout is set to the saved handle
+#else
+        args += "pipe:" + std::to_string(s_stream_fd >= 0 ? s_stream_fd : 1);
+#endif
+    } else if (is_stream_output(config.output_path)) {
+        args += config.output_path;
+    } else {
+        args += "\"" + config.output_path + "\"";
+    }
+    return args;
+}
+
+// Segment length for HLS/DASH packages. Every rendition gets a keyframe
+// forced on this grid so segment boundaries line up across the ladder.
+static const int PACKAGE_SEGMENT_SECONDS = 4;
+
+// Bitrate for ladder rungs without one: ~4 Mbps for 720p60 H.264
+static const double LADDER_BITS_PER_PIXEL = 0.07;
+
+// DASH segment templates use $...$ placeholders; the POSIX backend runs the
+// command through sh, so they must not be expanded there.
+static std::string escape_template(const std::string& s) {
+#ifdef _WIN32
+    return s;
+#else
+    std::string out;
+    for (char c : s) {
+        if (c == '$') out += '\\';
+        out += c;
+    }
+    return out;
+#endif
+}
+
+// Encode and package arguments for an HLS/DASH ladder: the frames are split
+// once, scaled per rendition, and all renditions share one encoder setup
+// with per-stream bitrates. Audio is encoded once and shared.
+static std::string build_package_args(const FFmpegConfig& config, const std::string& video_input,
+                                      bool has_audio) {
+    char buf[512];
+    std::vector<LadderRung> ladder = config.ladder;
+    if (ladder.empty()) ladder.push_back(LadderRung());
+
+    size_t count = ladder.size();
+    std::vector<int> heights(count);
+    std::vector<int> bitrates(count);
+    int top_bitrate = 0;
+    std::string graph = "[" + video_input + "]split=" + std::to_string(count);
+    for (size_t i = 0; i < count; i++) graph += "[v" + std::to_string(i) + "]";
+    for (size_t i = 0; i < count; i++) {
+        int h = ladder[i].height > 0 ? ladder[i].height
+              : config.scale_height > 0 ? config.scale_height : config.height;
+        int w = (int)((double)config.width * h / config.height + 1) & ~1;
+        heights[i] = h;
+        bitrates[i] = ladder[i].bitrate_kbps > 0 ? ladder[i].bitrate_kbps
+            : std::max(MIN_TARGET_VIDEO_KBPS, (int)(w * h * config.fps * LADDER_BITS_PER_PIXEL / 1000));
+        top_bitrate = std::max(top_bitrate, bitrates[i]);
+        snprintf(buf, sizeof(buf), ";[v%zu]scale=%d:%d:flags=lanczos[v%zus]", i, w, h, i);
+        graph += buf;
+    }
+
+    std::string args = "-filter_complex \"" + graph + "\" ";
+    for (size_t i = 0; i < count; i++) {
+        snprintf(buf, sizeof(buf), "-map \"[v%zus]\" ", i);
+        args += buf;
+    }
+    if (has_audio) args += "-map 0:a ";
+
+    // Rate control mode comes from the top rung; each stream then gets its own bitrate
+    args += build_encoder_flags(config.encoder, config.crf, config.preset, config.threads, top_bitrate);
+    for (size_t i = 0; i < count; i++) {
+        snprintf(buf, sizeof(buf), " -b:v:%zu %dk -maxrate:v:%zu %dk -bufsize:v:%zu %dk",
+                 i, bitrates[i], i, bitrates[i] * 3 / 2, i, bitrates[i] * 2);
+        args += buf;
+    }
+    int gop = (int)(config.fps * PACKAGE_SEGMENT_SECONDS + 0.5);
+    snprintf(buf, sizeof(buf), " -g %d -force_key_frames \"expr:gte(t,n_forced*%d)\"",
+             gop, PACKAGE_SEGMENT_SECONDS);
+    args += buf;
+    if (has_audio) args += " " + ffmpeg_audio_flags("aac") + " -shortest";
+
+    // Playlists and segments go next to the output, named after it
+    std::filesystem::path out(config.output_path);
+    std::string dir = out.parent_path().string();
+    if (!dir.empty()) dir += "/";
+    std::string stem = out.stem().string();
+
+    if (config.output_format == "hls") {
+        std::string stream_map;
+        for (size_t i = 0; i < count; i++) {
+            snprintf(buf, sizeof(buf), "%sv:%zu,name:%dp%s", i ? " " : "", i, heights[i],
+                     has_audio ? ",agroup:aud" : "");
+            stream_map += buf;
+        }
+        if (has_audio) stream_map += " a:0,agroup:aud,name:audio";
+
+        snprintf(buf, sizeof(buf),
+            " -f hls -hls_time %d -hls_list_size 0 -hls_playlist_type event"
+            " -hls_segment_type fmp4 -hls_flags independent_segments",
+            PACKAGE_SEGMENT_SECONDS);
+        args += buf;
+        args += " -master_pl_name \"" + out.filename().string() + "\"";
+        args += " -hls_fmp4_init_filename \"" + stem + "_%v_init.mp4\"";
+        args += " -hls_segment_filename \"" + dir + stem + "_%v_%05d.m4s\"";
+        args += " -var_stream_map \"" + stream_map + "\"";
+        args += " \"" + dir + stem + "_%v.m3u8\"";
+    } else {
+        snprintf(buf, sizeof(buf),
+            " -f dash -seg_duration %d -use_template 1 -use_timeline 1", PACKAGE_SEGMENT_SECONDS);
+        args += buf;
+        args += " -init_seg_name \"" + escape_template(stem + "_init_$RepresentationID$.m4s") + "\"";
+        args += " -media_seg_name \"" +
+                escape_template(stem + "_$RepresentationID$_$Number%05d$.m4s") + "\"";
+        args += has_audio ? " -adaptation_sets \"id=0,streams=v id=1,streams=a\""
+                          : " -adaptation_sets \"id=0,streams=v\"";
+        args += " \"" + config.output_path + "\"";
+    }
+    return args;
+}
+
+// Scale filter for the main output ("" when frames are encoded as captured)
+static std::string main_scale_filter(const FFmpegConfig& config) {
+    if (config.scale_width <= 0 || config.scale_height <= 0 ||
+        (config.scale_width == config.width && config.scale_height == config.height)) {
+        return "";
+    }
     char buf[128];
-    snprintf(buf, sizeof(buf), "-c:v libx264 -preset medium -crf %d -pix_fmt yuv420p", crf);
+    snprintf(buf, sizeof(buf), "scale=%d:%d:flags=%s", config.scale_width, config.scale_height,
+             config.scale_flags.c_str());
     return buf;
 }
 
+// Full ffmpeg command line for the pipe backend. Video is raw RGB24 on stdin;
+// when audio_input is set, live s16le stereo audio is read from that FIFO /
+// named pipe. Audio is listed first with a minimal probe so ffmpeg opens it
+// before it blocks probing stdin for the first video frame.
+static std::string build_pipe_command(const FFmpegConfig& config, const std::string& audio_input) {
+    char buf[512];
+    std::string cmd = "\"" + config.ffmpeg_path + "\" -y ";
+    bool has_audio = !audio_input.empty();
+
+    if (has_audio) {
+        snprintf(buf, sizeof(buf),
+            "-thread_queue_size 1024 -probesize 32 -analyzeduration 0 "
+            "-f s16le -ar %u -ac 2 -i \"%s\" ",
+            config.audio_rate, audio_input.c_str());
+        cmd += buf;
+    }
+
+    snprintf(buf, sizeof(buf),
+        "-thread_queue_size 64 -f rawvideo -pixel_format rgb24 -video_size %dx%d "
+        "-framerate %g -i pipe:0 ",
+        config.width, config.height, config.fps);
+    cmd += buf;
+
+    std::string video_input = has_audio ? "1:v" : "0:v";
+    if (is_package_format(config.output_format)) {
+        return cmd + build_package_args(config, video_input, has_audio);
+    }
+    std::string scale = main_scale_filter(config);
+    if (config.extra_outputs.empty()) {
+        if (has_audio) cmd += "-map " + video_input + " -map 0:a ";
+        if (!scale.empty()) cmd += "-vf " + scale + " ";
+        cmd += ffmpeg_encoder_flags(config);
+        if (has_audio) cmd += " " + ffmpeg_audio_flags(config.audio_codec) + " -shortest";
+        cmd += " " + build_output_args(config);
+        return cmd;
+    }
+
+    // Several outputs: split the decoded frames once, scale per output, and
+    // give each output its own encoder and audio encode.
+    size_t count = config.extra_outputs.size() + 1;
+    std::string graph = "[" + video_input + "]split=" + std::to_string(count);
+    for (size_t i = 0; i < count; i++) graph += "[v" + std::to_string(i) + "]";
+    // Outputs without their own size get the main output's scaling
+    if (!scale.empty()) graph += ";[v0]" + scale + "[v0s]";
+    for (size_t i = 1; i < count; i++) {
+        const FFmpegOutput& out = config.extra_outputs[i - 1];
+        if (out.width <= 0 && out.height <= 0) {
+            if (!scale.empty()) graph += ";[v" + std::to_string(i) + "]" + scale + "[v" + std::to_string(i) + "s]";
+            continue;
+        }
+        snprintf(buf, sizeof(buf), ";[v%zu]scale=%d:%d:flags=lanczos[v%zus]", i,
+                 out.width > 0 ? out.width : -2, out.height > 0 ? out.height : -2, i);
+        graph += buf;
+    }
+    cmd += "-filter_complex \"" + graph + "\" ";
+
+    cmd += scale.empty() ? "-map \"[v0]\" " : "-map \"[v0s]\" ";
+    if (has_audio) cmd += "-map 0:a ";
+    cmd += ffmpeg_encoder_flags(config);
+    if (has_audio) cmd += " " + ffmpeg_audio_flags(config.audio_codec) + " -shortest";
+    cmd += " " + build_output_args(config);
+
+    for (size_t i = 1; i < count; i++) {
+        const FFmpegOutput& out = config.extra_outputs[i - 1];
+        bool scaled = out.width > 0 || out.height > 0 || !scale.empty();
+        snprintf(buf, sizeof(buf), " -map \"[v%zu%s]\" ", i, scaled ? "s" : "");
+        cmd += buf;
+        if (has_audio) cmd += "-map 0:a ";
+        cmd += build_encoder_flags(out.encoder, out.crf, out.preset, 0, 0);
+        if (has_audio) cmd += " " + ffmpeg_audio_flags("aac") + " -shortest";
+        cmd += " \"" + out.path + "\"";
+    }
+    return cmd;
+}
+
+// How long to wait for ffmpeg to open the live audio pipe
+static const int AUDIO_CONNECT_TIMEOUT_MS = 10000;
+
+// Cap on audio queued before the encoder opens (~5 s at 48 kHz stereo)
+static const size_t MAX_PENDING_AUDIO = 1 << 20;
+
+static int s_audio_pipe_counter = 0;
+
 #ifdef _WIN32
 #include <windows.h>
 #include <io.h>
 #include <fcntl.h>
 
-static HANDLE s_child_process = nullptr;
-static HANDLE s_write_handle = nullptr;
+// Wait for ffmpeg to open our named pipe. The pipe is created in PIPE_NOWAIT
+// mode so this can poll and give up if the child exits, then switched back to
+// blocking mode for writes.
+static bool connect_audio_pipe(HANDLE pipe_handle, HANDLE process) {
+    for (int waited = 0; waited < AUDIO_CONNECT_TIMEOUT_MS; waited += 10) {
+        if (ConnectNamedPipe(pipe_handle, nullptr) || GetLastError() == ERROR_PIPE_CONNECTED) {
+            DWORD mode = PIPE_READMODE_BYTE | PIPE_WAIT;
+            SetNamedPipeHandleState(pipe_handle, &mode, nullptr, nullptr);
+            return true;
+        }
+        if (WaitForSingleObject(process, 10) == WAIT_OBJECT_0) return false;
+    }
+    return false;
+}
 
-bool FFmpegEncoder::open(const FFmpegConfig& config) {
+bool FFmpegEncoder::open_pipe(const FFmpegConfig& config) {
     frame_width = config.width;
     frame_height = config.height;
 
-    std::string enc_flags = build_encoder_flags(config.encoder, config.crf);
+    // Named pipe for live audio (ffmpeg opens it by path like a file)
+    std::string audio_name;
+    if (config.audio_rate > 0) {
+        char name[128];
+        snprintf(name, sizeof(name), "\\\\.\\pipe\\krec2mp4_audio_%lu_%d",
+                 GetCurrentProcessId(), s_audio_pipe_counter++);
+        audio_name = name;
+        HANDLE h = CreateNamedPipeA(name, PIPE_ACCESS_OUTBOUND,
+                                    PIPE_TYPE_BYTE | PIPE_NOWAIT, 1, 1 << 20, 0, 0, nullptr);
+        if (h == INVALID_HANDLE_VALUE) {
+            fprintf(stderr, "Error: CreateNamedPipe failed (%lu)\n", GetLastError());
+            return false;
+        }
+        audio_pipe = h;
+    }
 
     // Build FFmpeg command line
-    char cmd[2048];
-    snprintf(cmd, sizeof(cmd),
-        "\"%s\" -y -f rawvideo -pixel_format rgb24 -video_size %dx%d "
-        "-framerate %g -i pipe:0 "
-        "%s "
-        "\"%s\"",
-        config.ffmpeg_path.c_str(),
-        config.width, config.height,
-        config.fps,
-        enc_flags.c_str(),
-        config.output_path.c_str());
-
-    fprintf(stderr, "FFmpeg cmd: %s\n", cmd);
-
-    // Create pipe for stdin
-    SECURITY_ATTRIBUTES sa = {};
-    sa.nLength = sizeof(sa);
-    sa.bInheritHandle = TRUE;
+    std::string cmd = build_pipe_command(config, audio_name);
+    fprintf(stderr, "FFmpeg cmd: %s\n", cmd.c_str());
 
+    // Create pipe for stdin; only the read end is inheritable. The default
+    // pipe buffer is a few KB, so leave room for a whole write batch.
     HANDLE read_handle = nullptr;
-    if (!CreatePipe(&read_handle, &s_write_handle, &sa, 0)) {
+    HANDLE write_handle = nullptr;
+    if (!create_child_pipe(&read_handle, &write_handle, true, (unsigned long)(2 * WRITE_BATCH_BYTES))) {
         fprintf(stderr, "Error: CreatePipe failed (%lu)\n", GetLastError());
+        close_pipe();
         return false;
     }
 
-    // Don't let child inherit our write end
-    SetHandleInformation(s_write_handle, HANDLE_FLAG_INHERIT, 0);
-
     STARTUPINFOA si = {};
     si.cb = sizeof(si);
     si.dwFlags = STARTF_USESTDHANDLES;
     si.hStdInput = read_handle;
-    si.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+    si.hStdOutput = (config.output_path == "-" && s_stream_handle)
+        ? (HANDLE)s_stream_handle : GetStdHandle(STD_OUTPUT_HANDLE);
     si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
 
     PROCESS_INFORMATION pi = {};
-    if (!CreateProcessA(nullptr, cmd, nullptr, nullptr, TRUE, CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi)) {
-        fprintf(stderr, "Error: CreateProcess failed (%lu): %s\n", GetLastError(), cmd);
+    if (!CreateProcessA(nullptr, (LPSTR)cmd.c_str(), nullptr, nullptr, TRUE, CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi)) {
+        fprintf(stderr, "Error: CreateProcess failed (%lu): %s\n", GetLastError(), cmd.c_str());
         CloseHandle(read_handle);
-        CloseHandle(s_write_handle);
-        s_write_handle = nullptr;
+        CloseHandle(write_handle);
+        close_pipe();
         return false;
     }
 
     // Close handles we don't need
     CloseHandle(read_handle);
     CloseHandle(pi.hThread);
-    s_child_process = pi.hProcess;
+    child_process = pi.hProcess;
 
     // Wrap the write handle in a FILE* for fwrite convenience
-    int fd = _open_osfhandle((intptr_t)s_write_handle, 0);
+    int fd = _open_osfhandle((intptr_t)write_handle, 0);
     if (fd == -1) {
         fprintf(stderr, "Error: _open_osfhandle failed\n");
-        CloseHandle(s_write_handle);
-        s_write_handle = nullptr;
+        CloseHandle(write_handle);
+        close_pipe();
         return false;
     }
 
@@ -228,82 +807,736 @@ bool FFmpegEncoder::open(const FFmpegConfig& config) {
     if (!pipe) {
         fprintf(stderr, "Error: _fdopen failed\n");
         _close(fd);
-        s_write_handle = nullptr;
+        close_pipe();
+        return false;
+    }
+    // Batching happens in write_pipe; stdio's 4 KB buffer would only split
+    // every frame into extra WriteFile calls
+    setvbuf(pipe, nullptr, _IONBF, 0);
+
+    if (audio_pipe && !connect_audio_pipe((HANDLE)audio_pipe, (HANDLE)child_process)) {
+        fprintf(stderr, "Error: FFmpeg did not open the live audio pipe\n");
+        close_pipe();
         return false;
     }
 
     return true;
 }
 
-bool FFmpegEncoder::write_frame(const uint8_t* rgb_data, int width, int height) {
-    if (!pipe) return false;
+bool ffmpeg_reserve_stdout() {
+    if (s_stream_handle) return true;
+    int fd = _dup(_fileno(stdout));
+    if (fd < 0) return false;
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    SetHandleInformation(h, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+    fflush(stdout);
+    _dup2(_fileno(stderr), _fileno(stdout));
+    SetStdHandle(STD_OUTPUT_HANDLE, GetStdHandle(STD_ERROR_HANDLE));
+    s_stream_handle = h;
+    return true;
+}
 
-    size_t frame_size = (size_t)width * height * 3;
-    size_t written = fwrite(rgb_data, 1, frame_size, pipe);
-    if (written != frame_size) {
+FILE* ffmpeg_open_stream_output(const std::string& output_path) {
+    HANDLE src = output_path == "-"
+        ? (s_stream_handle ? (HANDLE)s_stream_handle : GetStdHandle(STD_OUTPUT_HANDLE))
+        : (HANDLE)_get_osfhandle(atoi(output_path.c_str() + 5));
+    HANDLE h = nullptr;
+    if (src == INVALID_HANDLE_VALUE ||
+        !DuplicateHandle(GetCurrentProcess(), src, GetCurrentProcess(), &h, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        return nullptr;
+    }
+    int fd = _open_osfhandle((intptr_t)h, 0);
+    if (fd == -1) {
+        CloseHandle(h);
+        return nullptr;
+    }
+    FILE* f = _fdopen(fd, "wb");
+    if (!f) _close(fd);
+    return f;
+}
+
+// The stream is unbuffered, so each call is a single WriteFile
+bool FFmpegEncoder::write_video(const uint8_t* data, size_t bytes) {
+    if (!pipe) return false;
+    write_stats.write_calls++;
+    if (fwrite(data, 1, bytes, pipe) != bytes) {
         fprintf(stderr, "Error: failed to write frame to FFmpeg pipe\n");
         return false;
     }
+    return true;
+}
 
+uint8_t* FFmpegEncoder::acquire_pipe_buffer(size_t size) {
+    return nullptr;
+}
+
+void FFmpegEncoder::release_frame_slots() {}
+
+bool FFmpegEncoder::write_audio_pipe(const uint8_t* pcm, size_t bytes) {
+    while (bytes > 0) {
+        DWORD written = 0;
+        if (!WriteFile((HANDLE)audio_pipe, pcm, (DWORD)bytes, &written, nullptr)) {
+            fprintf(stderr, "Error: failed to write audio to FFmpeg pipe (%lu)\n", GetLastError());
+            return false;
+        }
+        pcm += written;
+        bytes -= written;
+    }
     return true;
 }
 
-void FFmpegEncoder::close() {
+int FFmpegEncoder::close_pipe() {
+    int exit_code = -1;
+    finish_batch();
+    // Close audio first so ffmpeg sees EOF on both inputs
+    if (audio_pipe) {
+        FlushFileBuffers((HANDLE)audio_pipe);
+        CloseHandle((HANDLE)audio_pipe);
+        audio_pipe = nullptr;
+    }
     if (pipe) {
-        fclose(pipe);
+        fclose(pipe); // also closes the write handle
         pipe = nullptr;
-        s_write_handle = nullptr; // closed by fclose
     }
-    if (s_child_process) {
-        WaitForSingleObject(s_child_process, 30000);
-        CloseHandle(s_child_process);
-        s_child_process = nullptr;
+    if (child_process) {
+        WaitForSingleObject((HANDLE)child_process, 30000);
+        DWORD code = 0;
+        if (GetExitCodeProcess((HANDLE)child_process, &code) && code != STILL_ACTIVE) exit_code = (int)code;
+        CloseHandle((HANDLE)child_process);
+        child_process = nullptr;
     }
+    return exit_code;
 }
 
 #else
-// POSIX fallback
-bool FFmpegEncoder::open(const FFmpegConfig& config) {
+// POSIX: ffmpeg is started with posix_spawn on a raw pipe. On Linux the pipe
+// is enlarged with F_SETPIPE_SZ and frames are handed over with vmsplice from
+// a ring of page-aligned slots, so the kernel maps our pages instead of
+// copying each frame into the pipe.
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+// Open the write end of the FIFO once ffmpeg has opened it for reading.
+// O_NONBLOCK fails with ENXIO until a reader exists, so poll with a timeout
+// and give up early if ffmpeg has already exited.
+static int connect_audio_fifo(const std::string& path, pid_t child) {
+    for (int waited = 0; waited < AUDIO_CONNECT_TIMEOUT_MS; waited += 10) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd >= 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            return fd;
+        }
+        if (errno != ENXIO) break;
+        if (child > 0 && waitpid(child, nullptr, WNOHANG) == child) break;
+        usleep(10000);
+    }
+    return -1;
+}
+
+#ifdef __linux__
+// Largest pipe an unprivileged process may request
+static int max_pipe_size() {
+    int size = 1 << 20;
+    FILE* f = fopen("/proc/sys/fs/pipe-max-size", "r");
+    if (f) {
+        if (fscanf(f, "%d", &size) != 1) size = 1 << 20;
+        fclose(f);
+    }
+    return size;
+}
+#endif
+
+// Run the shell command line via posix_spawn ("exec" so the pid is ffmpeg's
+// own) with stdin connected to a new pipe. Returns the pid, or -1.
+static pid_t spawn_with_stdin_pipe(const std::string& cmd, int* write_fd) {
+    // Close-on-exec from the start: other threads spawn children too, and
+    // one that inherits our write end keeps ffmpeg from ever seeing EOF.
+    // The dup2 below gives the child its stdin without the flag.
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) != 0) return -1;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+
+    std::string shell_cmd = "exec " + cmd;
+    char* argv[] = { (char*)"sh", (char*)"-c", (char*)shell_cmd.c_str(), nullptr };
+    pid_t pid = -1;
+    int err = posix_spawn(&pid, "/bin/sh", &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    ::close(fds[0]);
+
+    if (err != 0) {
+        ::close(fds[1]);
+        return -1;
+    }
+    *write_fd = fds[1];
+    return pid;
+}
+
+bool FFmpegEncoder::open_pipe(const FFmpegConfig& config) {
     frame_width = config.width;
     frame_height = config.height;
 
-    std::string enc_flags = build_encoder_flags(config.encoder, config.crf);
+    // A dead ffmpeg must surface as a write error, not kill the process
+    signal(SIGPIPE, SIG_IGN);
 
-    char cmd[2048];
-    snprintf(cmd, sizeof(cmd),
-        "\"%s\" -y -f rawvideo -pixel_format rgb24 -video_size %dx%d "
-        "-framerate %g -i pipe:0 "
-        "%s "
-        "\"%s\"",
-        config.ffmpeg_path.c_str(),
-        config.width, config.height,
-        config.fps,
-        enc_flags.c_str(),
-        config.output_path.c_str());
-
-    pipe = popen(cmd, "w");
-    if (!pipe) {
-        fprintf(stderr, "Error: failed to start FFmpeg: %s\n", cmd);
+    if (config.audio_rate > 0) {
+        char name[128];
+        snprintf(name, sizeof(name), "krec2mp4_audio_%d_%d.pcm", (int)getpid(), s_audio_pipe_counter++);
+        audio_fifo_path = (std::filesystem::temp_directory_path() / name).string();
+        unlink(audio_fifo_path.c_str());
+        if (mkfifo(audio_fifo_path.c_str(), 0600) != 0) {
+            fprintf(stderr, "Error: mkfifo '%s' failed: %s\n", audio_fifo_path.c_str(), strerror(errno));
+            audio_fifo_path.clear();
+            return false;
+        }
+    }
+
+    std::string cmd = build_pipe_command(config, audio_fifo_path);
+    fprintf(stderr, "FFmpeg cmd: %s\n", cmd.c_str());
+
+    child_pid = spawn_with_stdin_pipe(cmd, &video_fd);
+    if (child_pid < 0) {
+        fprintf(stderr, "Error: failed to start FFmpeg: %s\n", cmd.c_str());
+        close_pipe();
         return false;
     }
+
+#ifdef __linux__
+    pipe_size = fcntl(video_fd, F_SETPIPE_SZ, max_pipe_size());
+    if (pipe_size <= 0) pipe_size = fcntl(video_fd, F_GETPIPE_SZ);
+    use_vmsplice = pipe_size > 0;
+#endif
+
+    if (!audio_fifo_path.empty()) {
+        audio_fd = connect_audio_fifo(audio_fifo_path, child_pid);
+        if (audio_fd < 0) {
+            fprintf(stderr, "Error: FFmpeg did not open the live audio FIFO\n");
+            close_pipe();
+            return false;
+        }
+        // Both ends are open; the path is no longer needed
+        unlink(audio_fifo_path.c_str());
+        audio_fifo_path.clear();
+    }
     return true;
 }
 
-bool FFmpegEncoder::write_frame(const uint8_t* rgb_data, int width, int height) {
-    if (!pipe) return false;
+bool ffmpeg_reserve_stdout() {
+    if (s_stream_fd >= 0) return true;
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0) return false;
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    s_stream_fd = fd;
+    return true;
+}
+
+FILE* ffmpeg_open_stream_output(const std::string& output_path) {
+    int src = output_path == "-" ? (s_stream_fd >= 0 ? s_stream_fd : STDOUT_FILENO)
+                                 : atoi(output_path.c_str() + 5);
+    int fd = dup(src);
+    if (fd < 0) return nullptr;
+    FILE* f = fdopen(fd, "wb");
+    if (!f) ::close(fd);
+    return f;
+}
+
+uint8_t* FFmpegEncoder::acquire_pipe_buffer(size_t size) {
+#ifdef __linux__
+    if (!use_vmsplice || video_fd < 0) return nullptr;
+
+    if (frame_slots.empty() || frame_slot_size < size) {
+        release_frame_slots();
+        // A slot may be rewritten once a full pipe's worth of later data has
+        // been spliced after it, since the pipe can't still reference it then.
+        long page = sysconf(_SC_PAGESIZE);
+        frame_slot_size = (size + page - 1) / page * page;
+        // Batched slots are not in the pipe yet, so they need slots of their own.
+        size_t count = (size_t)pipe_size / frame_slot_size + 2 + batch_limit;
+        for (size_t i = 0; i < count; i++) {
+            void* slot = nullptr;
+            if (posix_memalign(&slot, page, frame_slot_size) != 0) {
+                release_frame_slots();
+                use_vmsplice = false;
+                return nullptr;
+            }
+            frame_slots.push_back((uint8_t*)slot);
+        }
+        frame_slot_index = 0;
+    }
+    return frame_slots[frame_slot_index];
+#else
+    return nullptr;
+#endif
+}
+
+void FFmpegEncoder::release_frame_slots() {
+    for (uint8_t* slot : frame_slots) free(slot);
+    frame_slots.clear();
+    frame_slot_size = 0;
+    frame_slot_index = 0;
+}
+
+static bool write_all(int fd, const uint8_t* data, size_t bytes) {
+    while (bytes > 0) {
+        ssize_t n = ::write(fd, data, bytes);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+bool FFmpegEncoder::write_video(const uint8_t* data, size_t bytes) {
+    if (video_fd < 0) return false;
+    while (bytes > 0) {
+        write_stats.write_calls++;
+        ssize_t n = ::write(video_fd, data, bytes);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: failed to write frame to FFmpeg pipe: %s\n", strerror(errno));
+            return false;
+        }
+        data += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+#ifdef __linux__
+// Splice consecutive frame slots with as few vmsplice calls as the pipe allows
+bool FFmpegEncoder::splice_video(uint8_t* const* slots, size_t count, size_t frame_size) {
+    if (video_fd < 0) return false;
+    struct iovec iov[MAX_BATCH_FRAMES];
+    for (size_t i = 0; i < count; i++) iov[i] = { slots[i], frame_size };
+
+    // No SPLICE_F_GIFT: slots are reused, and ffmpeg read()s rather than
+    // splicing, so gifting would buy nothing and make reuse unsafe.
+    size_t first = 0;
+    while (first < count) {
+        write_stats.write_calls++;
+        ssize_t n = vmsplice(video_fd, iov + first, count - first, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: failed to write frame to FFmpeg pipe: %s\n", strerror(errno));
+            return false;
+        }
+        size_t done = (size_t)n;
+        while (first < count && done >= iov[first].iov_len) done -= iov[first++].iov_len;
+        if (first < count) {
+            iov[first].iov_base = (uint8_t*)iov[first].iov_base + done;
+            iov[first].iov_len -= done;
+        }
+    }
+    return true;
+}
+#endif
+
+bool FFmpegEncoder::write_audio_pipe(const uint8_t* pcm, size_t bytes) {
+    if (!write_all(audio_fd, pcm, bytes)) {
+        fprintf(stderr, "Error: failed to write audio to FFmpeg pipe: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+int FFmpegEncoder::close_pipe() {
+    int exit_code = -1;
+    finish_batch();
+    // Close audio first so ffmpeg sees EOF on both inputs
+    if (audio_fd >= 0) {
+        ::close(audio_fd);
+        audio_fd = -1;
+    }
+    if (!audio_fifo_path.empty()) {
+        unlink(audio_fifo_path.c_str());
+        audio_fifo_path.clear();
+    }
+    if (video_fd >= 0) {
+        ::close(video_fd);
+        video_fd = -1;
+    }
+    if (child_pid > 0) {
+        int status = 0;
+        pid_t waited;
+        while ((waited = waitpid(child_pid, &status, 0)) < 0 && errno == EINTR) {}
+        if (waited == child_pid) {
+            if (WIFEXITED(status)) exit_code = WEXITSTATUS(status);
+            else if (WIFSIGNALED(status)) exit_code = 128 + WTERMSIG(status);
+        }
+        child_pid = -1;
+    }
+    // ffmpeg has exited, so no pipe buffer can still reference the slots
+    release_frame_slots();
+    use_vmsplice = false;
+    return exit_code;
+}
+#endif
+
+// Pipe backend frame write. Frames go out one call each unless batching is
+// on (batch_limit > 1), in which case they queue until batch_limit are ready.
+bool FFmpegEncoder::write_pipe(const uint8_t* rgb_data, int width, int height) {
     size_t frame_size = (size_t)width * height * 3;
-    size_t written = fwrite(rgb_data, 1, frame_size, pipe);
-    if (written != frame_size) {
-        fprintf(stderr, "Error: failed to write frame to FFmpeg pipe\n");
+    uint8_t* slot = nullptr;
+    if (!frame_slots.empty() && rgb_data == frame_slots[frame_slot_index]) {
+        slot = frame_slots[frame_slot_index];
+        frame_slot_index = (frame_slot_index + 1) % (int)frame_slots.size();
+    }
+
+    if (batch_limit <= 1) {
+        bool ok = false;
+        if (!slot) ok = write_video(rgb_data, frame_size);
+#ifdef __linux__
+        else ok = splice_video(&slot, 1, frame_size);
+#endif
+        if (ok) {
+            segment_frames++;
+        } else {
+            // Kept unsent, like a failed batch, for write_frame's restart
+            write_batch.assign(rgb_data, rgb_data + frame_size);
+            batch_frame_size = frame_size;
+        }
+        return ok;
+    }
+
+    // Keep frames in order if the source switches between slots and its own buffers
+    if ((slot ? !write_batch.empty() : !batch_slots.empty()) && !flush_batch()) {
+        // The unsent frames stay queued as copies, this one behind them
+        spill_batch_slots();
+        write_batch.insert(write_batch.end(), rgb_data, rgb_data + frame_size);
         return false;
     }
+    if (slot) batch_slots.push_back(slot);
+    else write_batch.insert(write_batch.end(), rgb_data, rgb_data + frame_size);
+    batch_frame_size = frame_size;
+    size_t queued = slot ? batch_slots.size() : write_batch.size() / frame_size;
+    return queued < (size_t)batch_limit || flush_batch();
+}
+
+// Send the queued frames. A batch that fails stays queued, so a restart can
+// resend it; frames only count towards the segment once they are sent.
+bool FFmpegEncoder::flush_batch() {
+    if (write_batch.empty() && batch_slots.empty()) return true;
+    size_t frames = batch_slots.size() + write_batch.size() / batch_frame_size;
+    bool ok = true;
+    if (!write_batch.empty()) ok = write_video(write_batch.data(), write_batch.size());
+#ifdef __linux__
+    if (ok && !batch_slots.empty()) ok = splice_video(batch_slots.data(), batch_slots.size(), batch_frame_size);
+#endif
+    if (!ok) return false;
+    write_batch.clear();
+    batch_slots.clear();
+    segment_frames += frames;
     return true;
 }
 
-void FFmpegEncoder::close() {
-    if (pipe) {
-        pclose(pipe);
-        pipe = nullptr;
+// Copy frames queued by slot into write_batch, after any copied ones
+void FFmpegEncoder::spill_batch_slots() {
+    for (uint8_t* slot : batch_slots) {
+        write_batch.insert(write_batch.end(), slot, slot + batch_frame_size);
     }
+    batch_slots.clear();
 }
+
+void FFmpegEncoder::drop_batch() {
+    write_batch.clear();
+    batch_slots.clear();
+}
+
+// Send whatever is still queued before ffmpeg is closed. Frames that can't be
+// sent are recorded in the stats and dropped.
+bool FFmpegEncoder::finish_batch() {
+    if (flush_batch()) return true;
+    size_t frames = batch_slots.size() + write_batch.size() / batch_frame_size;
+    write_stats.errors.push_back(std::to_string(frames) + " queued frames never reached FFmpeg");
+    drop_batch();
+    return false;
+}
+
+// CPU time (user + system) used so far by the calling thread
+static double thread_cpu_seconds() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return 0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (double)(k.QuadPart + u.QuadPart) * 1e-7;
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
 #endif
+}
+
+double encoder_stats_percentile_ms(const EncoderStats& stats, double percentile) {
+    if (stats.frames == 0) return 0;
+    unsigned long long target = (unsigned long long)(stats.frames * percentile);
+    unsigned long long seen = 0;
+    for (int i = 0; i < ENCODER_LATENCY_BUCKETS; i++) {
+        seen += stats.latency_hist[i];
+        if (seen > target) return 0.125 * (double)(1 << i);
+    }
+    return stats.max_write_ms;
+}
+
+bool FFmpegEncoder::open(const FFmpegConfig& config) {
+    write_stats = EncoderStats();
+    if (config.chunk_workers > 1) {
+        chunks = chunk_pool_open(config);
+        return chunks != nullptr;
+    }
+    if (config.backend == EncoderBackend::Libav) {
+        if (!config.extra_outputs.empty()) {
+            fprintf(stderr, "Warning: the libav backend writes only the main output\n");
+        }
+        frame_width = config.width;
+        frame_height = config.height;
+        libav = libav_open(config);
+        return libav != nullptr;
+    }
+    if (config.backend == EncoderBackend::Y4M) {
+        frame_width = config.width;
+        frame_height = config.height;
+        std::lock_guard<std::mutex> lock(audio_mutex);
+        y4m = y4m_open(config);
+        if (y4m && !pending_audio.empty()) y4m_write_audio(y4m, pending_audio.data(), pending_audio.size());
+        pending_audio.clear();
+        return y4m != nullptr;
+    }
+    FFmpegConfig pipe_cfg = config;
+    segment_paths.clear();
+    if (config.recover) {
+        // Fragmented MP4 stays readable up to the last fragment if ffmpeg dies
+        // (Matroska already does)
+        if (pipe_cfg.output_format.empty() &&
+            std::filesystem::path(config.output_path).extension() == ".mp4") {
+            pipe_cfg.output_format = "fmp4";
+        }
+        pipe_config = pipe_cfg;
+        segment_paths.push_back(config.output_path);
+        segment_frames = 0;
+    }
+
+    // A 320x240 capture is 225 KB a frame: batching sends four per call
+    size_t frame_size = (size_t)config.width * config.height * 3;
+    batch_limit = 1;
+    if (config.batch_writes && frame_size > 0 && frame_size <= WRITE_BATCH_BYTES / 2) {
+        batch_limit = std::min(MAX_BATCH_FRAMES, (int)(WRITE_BATCH_BYTES / frame_size));
+        write_batch.reserve(frame_size * batch_limit);
+    }
+
+    std::lock_guard<std::mutex> lock(audio_mutex);
+    if (!open_pipe(pipe_cfg)) return false;
+
+    if (has_audio_input() && !pending_audio.empty()) {
+        write_audio_pipe(pending_audio.data(), pending_audio.size());
+    }
+    pending_audio.clear();
+    return true;
+}
+
+// Replace a dead ffmpeg with a new one writing the next segment. Frames still
+// queued in the old process are lost; everything from the failed frame on
+// goes to the new segment, so the emulation keeps going uninterrupted.
+//
+// The audio thread only waits for the two handovers: the dead process is
+// detached and reaped, and its replacement spawned (which can wait seconds for
+// the audio FIFO), outside audio_mutex. Audio arriving in between sees a
+// closed encoder and queues in pending_audio.
+bool FFmpegEncoder::restart_pipe() {
+    if (segment_paths.empty() || write_stats.restarts >= MAX_ENCODER_RESTARTS) return false;
+
+    FFmpegEncoder old;
+    {
+        std::lock_guard<std::mutex> lock(audio_mutex);
+        swap_pipe(old);
+    }
+    int exit_code = old.close_pipe();
+    char msg[512];
+    snprintf(msg, sizeof(msg), "FFmpeg failed at frame %llu (exit code %d)", write_stats.frames, exit_code);
+
+    // A process that died before taking a single frame will die again
+    if (segment_frames == 0) {
+        write_stats.errors.push_back(std::string(msg) + "; not restarting, it wrote nothing");
+        write_stats.restarts = MAX_ENCODER_RESTARTS;
+        return false;
+    }
+
+    std::filesystem::path first(segment_paths[0]);
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".seg%03d", (int)segment_paths.size());
+    pipe_config.output_path = segment_paths[0] + suffix + first.extension().string();
+    segment_paths.push_back(pipe_config.output_path);
+    segment_frames = 0;
+    write_stats.restarts++;
+
+    FFmpegEncoder next;
+    next.batch_limit = batch_limit;
+    if (!next.open_pipe(pipe_config)) {
+        write_stats.errors.push_back(std::string(msg) + "; restart failed");
+        write_stats.restarts = MAX_ENCODER_RESTARTS;
+        std::lock_guard<std::mutex> lock(audio_mutex);
+        pending_audio.clear();
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(audio_mutex);
+        swap_pipe(next);
+        if (has_audio_input() && !pending_audio.empty()) {
+            write_audio_pipe(pending_audio.data(), pending_audio.size());
+        }
+        pending_audio.clear();
+    }
+    write_stats.errors.push_back(std::string(msg) + "; continued in " + pipe_config.output_path);
+    fprintf(stderr, "Warning: %s\n", write_stats.errors.back().c_str());
+    return true;
+}
+
+// Exchange the running ffmpeg process, its pipes and frame slots with other's
+void FFmpegEncoder::swap_pipe(FFmpegEncoder& other) {
+    std::swap(pipe, other.pipe);
+    std::swap(video_fd, other.video_fd);
+    std::swap(child_pid, other.child_pid);
+    std::swap(child_process, other.child_process);
+    std::swap(audio_pipe, other.audio_pipe);
+    std::swap(audio_fd, other.audio_fd);
+    std::swap(audio_fifo_path, other.audio_fifo_path);
+    std::swap(frame_slots, other.frame_slots);
+    std::swap(frame_slot_size, other.frame_slot_size);
+    std::swap(frame_slot_index, other.frame_slot_index);
+    std::swap(pipe_size, other.pipe_size);
+    std::swap(use_vmsplice, other.use_vmsplice);
+}
+
+// Join the recovery segments back into the output path
+bool FFmpegEncoder::join_segments() {
+    std::filesystem::path first(segment_paths[0]);
+    std::string joined = segment_paths[0] + ".joined" + first.extension().string();
+    std::error_code ec;
+    bool ok = ffmpeg_concat_files(pipe_config.ffmpeg_path, segment_paths, joined);
+    if (ok) {
+        for (const auto& path : segment_paths) std::filesystem::remove(path, ec);
+        std::filesystem::rename(joined, segment_paths[0], ec);
+    } else {
+        std::filesystem::remove(joined, ec);
+        write_stats.errors.push_back("joining " + std::to_string(segment_paths.size()) +
+                                     " recovered segments failed; they are kept next to " +
+                                     segment_paths[0]);
+    }
+    segment_paths.clear();
+    return ok;
+}
+
+bool FFmpegEncoder::write_audio(const uint8_t* pcm, size_t bytes) {
+    std::lock_guard<std::mutex> lock(audio_mutex);
+    if (!is_open()) {
+        // Audio can arrive before the first video frame opens the encoder
+        if (pending_audio.size() + bytes <= MAX_PENDING_AUDIO) {
+            pending_audio.insert(pending_audio.end(), pcm, pcm + bytes);
+        }
+        return true;
+    }
+    if (y4m) return y4m_write_audio(y4m, pcm, bytes);
+    if (!has_audio_input()) return false;
+    return write_audio_pipe(pcm, bytes);
+}
+
+uint8_t* FFmpegEncoder::acquire_frame_buffer(size_t size) {
+    if (chunks) return chunk_pool_acquire(chunks, size);
+    if (libav || y4m) return nullptr;
+    return acquire_pipe_buffer(size);
+}
+
+bool FFmpegEncoder::write_frame(const uint8_t* rgb_data, int width, int height) {
+    auto start = std::chrono::steady_clock::now();
+    double cpu_start = thread_cpu_seconds();
+    if (write_stats.frames == 0) first_write = start;
+
+    bool ok;
+    if (chunks) ok = chunk_pool_write_frame(chunks, rgb_data, width, height);
+    else if (libav) ok = libav_write_frame(libav, rgb_data, width, height);
+    else if (y4m) ok = y4m_write_frame(y4m, rgb_data, width, height);
+    else {
+        ok = write_pipe(rgb_data, width, height);
+        if (!ok && !segment_paths.empty()) {
+            // Everything the dead process never got (the queued batch and this
+            // frame) goes to the new one. The restart frees the pipe slots, so
+            // the frames are copied out of them first.
+            spill_batch_slots();
+            std::vector<uint8_t> unsent(write_batch.begin(), write_batch.end());
+            drop_batch();
+            size_t frame_size = (size_t)width * height * 3;
+            ok = restart_pipe();
+            for (size_t offset = 0; ok && offset < unsent.size(); offset += frame_size) {
+                ok = write_pipe(unsent.data() + offset, width, height);
+            }
+        }
+        // Unrecoverable: don't let unsent frames pile up behind a dead pipe
+        if (!ok) drop_batch();
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    write_stats.write_cpu_seconds += thread_cpu_seconds() - cpu_start;
+    write_stats.frames++;
+    write_stats.bytes += (unsigned long long)width * height * 3;
+    write_stats.write_seconds += ms / 1000.0;
+    if (ms > write_stats.max_write_ms) write_stats.max_write_ms = ms;
+    if (ms > ENCODER_STALL_MS) {
+        write_stats.stalls++;
+        write_stats.stall_seconds += ms / 1000.0;
+    }
+    int bucket = 0;
+    while (bucket < ENCODER_LATENCY_BUCKETS - 1 && ms >= 0.125 * (double)(1 << bucket)) bucket++;
+    write_stats.latency_hist[bucket]++;
+    return ok;
+}
+
+bool FFmpegEncoder::close() {
+    if (write_stats.frames > 0 && write_stats.wall_seconds == 0) {
+        write_stats.wall_seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - first_write).count();
+    }
+    bool ok = true;
+    if (chunks) {
+        write_stats.queue_fill = chunk_pool_queue_fill(chunks);
+        if (!chunk_pool_close(chunks)) {
+            write_stats.errors.push_back("chunked encode failed");
+            ok = false;
+        }
+        chunks = nullptr;
+    }
+    if (libav) {
+        libav_close(libav);
+        libav = nullptr;
+    }
+    if (y4m) {
+        std::lock_guard<std::mutex> lock(audio_mutex);
+        y4m_close(y4m);
+        y4m = nullptr;
+    }
+    if (!finish_batch()) ok = false;
+    close_pipe();
+    if (segment_paths.size() > 1 && !join_segments()) ok = false;
+    segment_paths.clear();
+    pending_audio.clear();
+    return ok;
+}
@@ -1,5 +1,8 @@
 #pragma once
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -9,6 +12,8 @@ enum class EncoderFamily {
     AMF_AV1,    // av1_amf — QP 0-255
     NVENC,      // h264_nvenc, hevc_nvenc — CQ 0-51
     NVENC_AV1,  // av1_nvenc — CQ 0-255
+    SVT_AV1,    // libsvtav1 — CRF 0-63
+    VP9,        // libvpx-vp9 — CRF 0-63
 };
 
 struct QualityPreset {
@@ -29,14 +34,58 @@ const QualityFamily& get_quality_family(EncoderFamily family);
 struct EncoderInfo {
     const wchar_t* label;
     const char* codec;
-    bool hw;  // true = needs hardware probe
+    bool hw;  // true = needs probe (GPU codecs, or CPU libraries not every ffmpeg build has)
     EncoderFamily family;
 };
 
 // Returns the subset of known encoders available on this system.
-// CPU encoders are always included; GPU encoders are tested by running
-// a quick FFmpeg encode and checking the exit code.
-std::vector<EncoderInfo> probe_available_encoders(const std::string& ffmpeg_path);
+// CPU encoders are always included; GPU encoders are tested in parallel by
+// running a quick FFmpeg encode each and checking the exit code.
+// With a cache_path, results are stored there and reused until the ffmpeg
+// binary's path, size or mtime changes.
+std::vector<EncoderInfo> probe_available_encoders(const std::string& ffmpeg_path,
+                                                  const std::string& cache_path = "");
+
+// Find a known encoder by FFmpeg codec name (nullptr if unknown).
+const EncoderInfo* find_encoder_info(const std::string& codec);
+
+enum class EncoderBackend {
+    Pipe,   // spawn ffmpeg and pipe raw RGB24 frames to its stdin
+    Libav,  // encode in-process with libavcodec/libavformat (KREC2MP4_LIBAV builds only)
+    Y4M,    // write a raw YUV4MPEG2 stream for an external encoder (no ffmpeg)
+};
+
+// Parse "pipe" / "libav" / "y4m". Returns false for unknown names.
+bool parse_encoder_backend(const std::string& name, EncoderBackend& out);
+
+// True if this build includes the in-process libavcodec backend.
+bool libav_backend_available();
+
+// An additional file encoded from the same frames (e.g. a small preview next
+// to the archive). Width/height 0 keep the source size; one of them 0 keeps
+// the aspect ratio.
+struct FFmpegOutput {
+    std::string path;
+    std::string encoder = "libx264";
+    int crf = 23;
+    std::string preset;
+    int width = 0;
+    int height = 0;
+};
+
+// Parse "<path>[,encoder=<codec>][,crf=<n>][,preset=<name>][,height=<h>][,res=<WxH>]".
+// Returns false on an unknown key or bad value.
+bool parse_output_spec(const std::string& spec, FFmpegOutput& out);
+
+// One rendition of an HLS/DASH package. Height 0 keeps the source size;
+// bitrate 0 picks one from the rendition's pixel rate.
+struct LadderRung {
+    int height = 0;
+    int bitrate_kbps = 0;
+};
+
+// Parse "<height>[:<kbps>],..." (e.g. "1440,720:3000,360"). Returns false on a bad entry.
+bool parse_ladder_spec(const std::string& spec, std::vector<LadderRung>& out);
 
 struct FFmpegConfig {
     std::string ffmpeg_path = "ffmpeg";
@@ -45,18 +94,193 @@ struct FFmpegConfig {
     int width = 640;
     int height = 480;
     double fps = 60.0;
+    int scale_width = 0;          // >0: encoder scales frames to scale_width x scale_height
+    int scale_height = 0;
+    std::string scale_flags = "lanczos"; // scaler: "neighbor" or "lanczos"
     int crf = 23;
+    std::string preset;           // encoder speed preset ("" = per-encoder default)
+    int threads = 0;              // CPU encoder threads (0 = encoder default)
+    int bitrate_kbps = 0;         // >0: average-bitrate rate control instead of crf
+    EncoderBackend backend = EncoderBackend::Pipe;
+    unsigned int audio_rate = 0;  // >0: take live s16le stereo audio at this rate (pipe backend)
+    std::string audio_codec = "aac"; // "aac" or "pcm_s16le" (lossless capture)
+    std::string audio_path;       // y4m backend: live audio sink, WAV for ".wav" else raw s16le
+    std::string output_format;    // "" = by extension, "fmp4" or "mpegts" (streamable),
+                                  // "hls" or "dash" (segmented package, output_path = playlist)
+    std::vector<LadderRung> ladder; // hls/dash renditions (empty = one at the source size)
+    bool segmented = false;       // write <stem>_NNN.<ext> segments plus a .segments.csv index
+    std::vector<double> segment_times; // segmented: split points in seconds
+    std::vector<FFmpegOutput> extra_outputs; // encoded in the same pass (pipe backend)
+    int chunk_workers = 0;        // >1: encode keyframe-aligned chunks in parallel processes (video only)
+    int chunk_frames = 0;         // frames per chunk, 0 = auto from resolution
+    bool recover = false;         // pipe backend, file output: if ffmpeg dies, continue in a
+                                  // new segment and join the segments at close
+    bool batch_writes = true;     // pipe backend: send small frames several per write call
+};
+
+// True for outputs that are streams rather than files: "-" (stdout) or "pipe:N".
+bool is_stream_output(const std::string& output_path);
+
+// True for the segmented package formats ("hls", "dash").
+bool is_package_format(const std::string& format);
+
+// Muxer flags for a streamable --format ("fmp4", "mpegts"); empty for the default MP4.
+std::string ffmpeg_format_args(const std::string& format);
+
+// Output file extension for a format: ".m3u8" (hls), ".mpd" (dash), ".y4m", else ".mp4".
+const char* output_extension(const std::string& format);
+
+// Segment file pattern ("<dir>/<stem>_%03d<ext>") and index ("<dir>/<stem>.segments.csv")
+// for a segmented output.
+std::string segment_file_pattern(const std::string& output_path);
+std::string segment_index_path(const std::string& output_path);
+
+// Join files with the same stream layout into output_path with ffmpeg's
+// concat demuxer (stream copy). Returns false if ffmpeg fails.
+bool ffmpeg_concat_files(const std::string& ffmpeg_path, const std::vector<std::string>& inputs,
+                         const std::string& output_path);
+
+// Reserve the process's stdout for "-" outputs: the original stdout is kept
+// aside for ffmpeg and our own stdout is redirected to stderr so log output
+// cannot corrupt the stream. Call once before any encoder opens.
+bool ffmpeg_reserve_stdout();
+
+// Open a stream output ("-" = the reserved stdout, "pipe:N") for writing
+// from this process. Returns nullptr on failure.
+FILE* ffmpeg_open_stream_output(const std::string& output_path);
+
+// Speed presets an encoder accepts, fastest first (empty for unknown encoders).
+std::vector<std::string> encoder_speed_presets(const std::string& encoder);
+
+// Encoder-specific FFmpeg arguments ("-c:v <codec> -<option> <value> ... -pix_fmt <fmt>").
+// Shared by both backends so quality/preset tuning lives in one place.
+std::string ffmpeg_encoder_flags(const FFmpegConfig& config);
+
+// AAC bitrate used for every encoded output
+static const int AUDIO_BITRATE_KBPS = 192;
+// Floor for size-targeted video bitrates; below this the target is unreachable anyway
+static const int MIN_TARGET_VIDEO_KBPS = 100;
+
+// Video bitrate (kbps) that fits size_mb (10^6 bytes) over the given duration
+// alongside audio_kbps of audio, with a margin for container overhead.
+int target_video_bitrate_kbps(double size_mb, double duration_seconds, int audio_kbps);
+
+// True if the encoder takes ffmpeg's generic -pass 1/2 two-pass rate control.
+bool encoder_supports_two_pass(const std::string& encoder);
+
+// Audio codec arguments for the output ("-c:a aac -b:a 192k", "-c:a pcm_s16le").
+std::string ffmpeg_audio_flags(const std::string& audio_codec);
+
+struct LibavState;
+struct Y4mState;
+struct ChunkPool;
+
+// Writes slower than this count as stalls (encoder not draining the pipe)
+static const double ENCODER_STALL_MS = 4.0;
+static const int ENCODER_LATENCY_BUCKETS = 12;
+// Give up recovering after this many ffmpeg restarts in one job
+static const int MAX_ENCODER_RESTARTS = 5;
+// Pipe write batching: frames up to half this size are coalesced, at most
+// MAX_BATCH_FRAMES per write (~67 ms of extra latency at 60 fps)
+static const size_t WRITE_BATCH_BYTES = 1 << 20;
+static const int MAX_BATCH_FRAMES = 4;
+
+// Per-job write_frame telemetry, reset by open() and kept after close().
+struct EncoderStats {
+    unsigned long long frames = 0;
+    unsigned long long bytes = 0;
+    double wall_seconds = 0;     // first write to close
+    double write_seconds = 0;    // total time blocked in write_frame
+    double max_write_ms = 0;
+    unsigned long long stalls = 0;
+    double stall_seconds = 0;
+    double queue_fill = -1;      // chunked encode: mean worker queue fill 0-1 (-1 = n/a)
+    // Write latency histogram: bucket i counts writes under 0.125 ms * 2^i
+    // (the last bucket takes everything slower)
+    unsigned long long latency_hist[ENCODER_LATENCY_BUCKETS] = {};
+    unsigned long long write_calls = 0; // pipe backend: video write/vmsplice calls issued
+    double write_cpu_seconds = 0; // encode-thread CPU time spent in write_frame
+    int restarts = 0;            // ffmpeg processes replaced after dying mid-stream
+    std::vector<std::string> errors; // one entry per failure (recovered or not)
 };
 
+// Upper bound of the histogram bucket holding the given percentile (0-1), in ms.
+double encoder_stats_percentile_ms(const EncoderStats& stats, double percentile);
+
 class FFmpegEncoder {
 public:
     bool open(const FFmpegConfig& config);
+    // Optional zero-copy destination for the next frame: fill it and pass it
+    // straight to write_frame(). Returns nullptr when the backend has no use
+    // for it (callers then write from their own buffer).
+    uint8_t* acquire_frame_buffer(size_t size);
     bool write_frame(const uint8_t* rgb_data, int width, int height);
-    void close();
-    bool is_open() const { return pipe != nullptr; }
+    // Live audio (FFmpegConfig::audio_rate > 0): interleaved s16le stereo PCM.
+    // Audio written before open() is queued and sent once the encoder starts.
+    bool write_audio(const uint8_t* pcm, size_t bytes);
+    // Returns false if the output could not be completed (a failed chunk
+    // encode, segment join or final batch write, also recorded in
+    // stats().errors).
+    bool close();
+    bool is_open() const { return pipe != nullptr || video_fd >= 0 || libav != nullptr || chunks != nullptr ||
+                                  y4m != nullptr; }
+    const EncoderStats& stats() const { return write_stats; }
 
 private:
-    FILE* pipe = nullptr;
+    bool open_pipe(const FFmpegConfig& config);
+    uint8_t* acquire_pipe_buffer(size_t size);
+    bool write_pipe(const uint8_t* rgb_data, int width, int height);
+    bool write_audio_pipe(const uint8_t* pcm, size_t bytes);
+    int close_pipe();  // returns ffmpeg's exit code (-1 if unknown)
+    bool restart_pipe();
+    void swap_pipe(FFmpegEncoder& other);
+    bool join_segments();
+    void release_frame_slots();
+    bool write_video(const uint8_t* data, size_t bytes);
+    bool splice_video(uint8_t* const* slots, size_t count, size_t frame_size);
+    bool flush_batch();
+    void spill_batch_slots();
+    void drop_batch();
+    bool finish_batch();
+    bool has_audio_input() const { return audio_pipe != nullptr || audio_fd >= 0; }
+
+    FILE* pipe = nullptr;           // Windows: ffmpeg stdin
+    int video_fd = -1;              // POSIX: ffmpeg stdin pipe
+    int child_pid = -1;             // POSIX: ffmpeg pid
+    LibavState* libav = nullptr;
+    Y4mState* y4m = nullptr;
+    ChunkPool* chunks = nullptr;
+    void* child_process = nullptr;  // Windows: ffmpeg process handle
+    void* audio_pipe = nullptr;     // Windows: live audio named pipe
+    int audio_fd = -1;              // POSIX: live audio FIFO write end
+    std::string audio_fifo_path;
+    std::vector<uint8_t> pending_audio;
+
+    // Linux vmsplice ring: page-aligned frame slots handed to the pipe by reference
+    std::vector<uint8_t*> frame_slots;
+    size_t frame_slot_size = 0;
+    int frame_slot_index = 0;
+    int pipe_size = 0;
+    bool use_vmsplice = false;
     int frame_width = 0;
     int frame_height = 0;
+
+    // Small-frame batching (FFmpegConfig::batch_writes): copied frames, or on
+    // the vmsplice path the slots not yet spliced, sent with one call. After a
+    // failed write it holds every unsent frame until write_frame restarts.
+    int batch_limit = 1;            // frames per write call (1 = unbatched)
+    std::vector<uint8_t> write_batch;
+    std::vector<uint8_t*> batch_slots;
+    size_t batch_frame_size = 0;
+
+    // Recovery (FFmpegConfig::recover): the running segment's config, every
+    // segment written so far (the first is the output path itself), and a
+    // lock so audio writes never race a restart on the encode thread.
+    FFmpegConfig pipe_config;
+    std::vector<std::string> segment_paths;
+    unsigned long long segment_frames = 0;
+    std::mutex audio_mutex;
+
+    EncoderStats write_stats;
+    std::chrono::steady_clock::time_point first_write;
 };
@@ -1,11 +1,15 @@
 #include "frame_capture.h"
 #include "pif_replay.h"
+#include "frame_hash.h"
+#include "row_pool.h"
 #include <cstdio>
 #include <cstring>
 #include <vector>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <algorithm>
 
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_opengl.h>
@@ -40,11 +44,17 @@ static FFmpegEncoder* s_encoder = nullptr;
 static FFmpegConfig s_ff_config;
 static bool s_encoder_opened = false;
 static int s_captured_frames = 0;
+static std::atomic<int> s_submitted_frames{0}; // frames entered into the pipeline (emulation thread)
 static int s_total_frames = 0;
+static int s_frame_limit = 0;
 static bool s_speed_limiter_disabled = false;
 static ProgressCallback s_progress_callback;
 static std::atomic<bool>* s_cancel_flag = nullptr;
 
+// Optional per-frame hash sidecar (written from the encode thread)
+static std::string s_hash_path;
+static FrameHashWriter s_hash_writer;
+
 // PBO double-buffering state
 static GLuint s_pbo[2] = {0, 0};
 static int s_pbo_index = 0;
@@ -65,6 +75,34 @@ static bool s_encode_shutdown = false;
 static int s_encode_width = 0;
 static int s_encode_height = 0;
 
+// Row-band pool for the flip; sized per resolution in init_pbos()
+static RowPool s_row_pool;
+static int s_worker_threads = 0;         // 0 = auto
+static double s_flip_seconds = 0;
+static int s_flip_frames = 0;
+
+// Backpressure telemetry: how long emulation waits for the encode thread
+static std::chrono::steady_clock::time_point s_capture_start;
+static FrameCaptureStats s_stats;
+
+// Flip a bottom-up RGB24 image into top-down order, split across the row pool
+static void flip_rows(uint8_t* dst, const uint8_t* src, int width, int height) {
+    size_t stride = (size_t)width * 3;
+    s_row_pool.run(height, [=](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            memcpy(dst + y * stride, src + (height - 1 - y) * stride, stride);
+        }
+    });
+}
+
+// Extra flip threads for a frame size: one per ~2 MB, up to half the cores
+static int auto_worker_threads(int width, int height) {
+    size_t frame_size = (size_t)width * height * 3;
+    int max_threads = (int)std::thread::hardware_concurrency() / 2;
+    int wanted = (int)(frame_size / (2 * 1024 * 1024));
+    return std::max(0, std::min(wanted, max_threads) - 1);
+}
+
 static void encode_worker() {
     while (true) {
         std::unique_lock<std::mutex> lock(s_encode_mutex);
@@ -74,24 +112,32 @@ static void encode_worker() {
 
         int width = s_encode_width;
         int height = s_encode_height;
-        int stride = width * 3;
-        size_t frame_size = (size_t)stride * height;
+        size_t frame_size = (size_t)width * height * 3;
 
-        if (s_flipped_buffer.size() < frame_size)
-            s_flipped_buffer.resize(frame_size);
+        // Flip straight into the encoder's zero-copy slot when it offers one
+        uint8_t* frame = s_encoder->acquire_frame_buffer(frame_size);
+        if (!frame) {
+            if (s_flipped_buffer.size() < frame_size)
+                s_flipped_buffer.resize(frame_size);
+            frame = s_flipped_buffer.data();
+        }
 
         // Flip vertically
-        for (int y = 0; y < height; y++) {
-            memcpy(s_flipped_buffer.data() + y * stride,
-                   s_staging_buffer.data() + (height - 1 - y) * stride, stride);
-        }
+        auto flip_start = std::chrono::steady_clock::now();
+        flip_rows(frame, s_staging_buffer.data(), width, height);
+        s_flip_seconds += std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - flip_start).count();
+        s_flip_frames++;
 
         s_encode_has_work = false;
         lock.unlock();
         s_encode_done_cv.notify_one();
 
         // Write to FFmpeg (outside lock so emulation thread can continue)
-        s_encoder->write_frame(s_flipped_buffer.data(), width, height);
+        s_encoder->write_frame(frame, width, height);
+        if (s_hash_writer.is_open()) {
+            s_hash_writer.write(s_captured_frames, frame_hash_compute(frame, width, height));
+        }
         s_captured_frames++;
 
         if (s_progress_callback) {
@@ -119,7 +165,13 @@ static void stop_encode_thread() {
 // Wait for the encode thread to finish its current frame
 static void wait_for_encode() {
     std::unique_lock<std::mutex> lock(s_encode_mutex);
+    if (!s_encode_has_work) return;
+
+    auto start = std::chrono::steady_clock::now();
     s_encode_done_cv.wait(lock, [] { return !s_encode_has_work; });
+    s_stats.wait_seconds += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    s_stats.waits++;
 }
 
 static bool init_pbo_functions() {
@@ -149,12 +201,26 @@ static void init_pbos(int width, int height) {
     s_pbo_initialized = true;
 
     s_staging_buffer.resize(size);
+    int threads = s_worker_threads > 0 ? s_worker_threads - 1 : auto_worker_threads(width, height);
+    s_row_pool.start(threads);
+    s_flip_seconds = 0;
+    s_flip_frames = 0;
+    s_stats = FrameCaptureStats();
+    s_capture_start = std::chrono::steady_clock::now();
     start_encode_thread();
 }
 
 static void cleanup_pbos() {
     if (s_pbo_initialized) {
         stop_encode_thread();
+        s_stats.wall_seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - s_capture_start).count();
+        s_stats.flip_seconds = s_flip_seconds;
+        if (s_flip_frames > 0) {
+            fprintf(stderr, "Frame capture: %d flip band(s), %.3f ms/frame over %d frames\n",
+                    s_row_pool.num_bands(), s_flip_seconds * 1000.0 / s_flip_frames, s_flip_frames);
+        }
+        s_row_pool.stop();
         glDeleteBuffers_fn(2, s_pbo);
         s_pbo[0] = s_pbo[1] = 0;
         s_pbo_initialized = false;
@@ -175,6 +241,7 @@ static void process_pbo_async(int pbo_idx, int width, int height) {
         glUnmapBuffer_fn(GL_PIXEL_PACK_BUFFER);
 
         // Signal encode thread
+        s_stats.frames++;
         {
             std::lock_guard<std::mutex> lock(s_encode_mutex);
             s_encode_width = width;
@@ -193,6 +260,7 @@ void frame_capture_init(Emulator* emu, FFmpegEncoder* encoder, const FFmpegConfi
     s_ff_config = ff_config;
     s_encoder_opened = false;
     s_captured_frames = 0;
+    s_submitted_frames = 0;
     s_total_frames = total_frames;
     s_speed_limiter_disabled = false;
     // Keep buffers allocated across batch runs to avoid reallocation
@@ -200,6 +268,22 @@ void frame_capture_init(Emulator* emu, FFmpegEncoder* encoder, const FFmpegConfi
     s_cancel_flag = nullptr;
     s_pbo_initialized = false;
     s_pbo_has_data = false;
+    s_hash_path.clear();
+    s_worker_threads = 0;
+    s_frame_limit = 0;
+    s_stats = FrameCaptureStats();
+}
+
+void frame_capture_set_worker_threads(int threads) {
+    s_worker_threads = threads;
+}
+
+void frame_capture_set_frame_limit(int frames) {
+    s_frame_limit = frames;
+}
+
+void frame_capture_set_hash_output(const std::string& path) {
+    s_hash_path = path;
 }
 
 void frame_capture_set_progress_callback(ProgressCallback cb) {
@@ -214,6 +298,14 @@ int frame_capture_count() {
     return s_captured_frames;
 }
 
+FrameCaptureStats frame_capture_stats() {
+    return s_stats;
+}
+
+int frame_capture_submitted_count() {
+    return s_submitted_frames.load();
+}
+
 void frame_capture_flush() {
     if (s_pbo_initialized && s_pbo_has_data) {
         int prev = 1 - s_pbo_index;
@@ -222,6 +314,7 @@ void frame_capture_flush() {
     // Wait for final encode to complete before cleanup
     wait_for_encode();
     cleanup_pbos();
+    s_hash_writer.close();
 }
 
 void frame_capture_callback(unsigned int frame_index) {
@@ -245,7 +338,7 @@ void frame_capture_callback(unsigned int frame_index) {
     pif_replay_reset_frame_sync();
 
     // Check if replay is done
-    if (pif_replay_finished()) {
+    if (pif_replay_finished() || (s_frame_limit > 0 && s_submitted_frames >= s_frame_limit)) {
         if (s_emu) {
             s_emu->stop();
         }
@@ -273,22 +366,27 @@ void frame_capture_callback(unsigned int frame_index) {
             return;
         }
         s_encoder_opened = true;
+
+        if (!s_hash_path.empty()) {
+            s_hash_writer.open(s_hash_path, width, height, s_ff_config.fps);
+        }
     }
 
     // Initialize PBOs + encode thread on first frame
     if (!s_pbo_initialized) {
         if (!init_pbo_functions()) {
             fprintf(stderr, "Warning: PBO functions not available, falling back to sync readback\n");
+            s_submitted_frames++;
             size_t frame_size = (size_t)width * height * 3;
             std::vector<uint8_t> pixel_buffer(frame_size);
             s_emu->read_screen(pixel_buffer.data(), &width, &height);
             if (s_flipped_buffer.size() < frame_size) s_flipped_buffer.resize(frame_size);
-            int stride = width * 3;
-            for (int y = 0; y < height; y++) {
-                memcpy(s_flipped_buffer.data() + y * stride,
-                       pixel_buffer.data() + (height - 1 - y) * stride, stride);
-            }
+            flip_rows(s_flipped_buffer.data(), pixel_buffer.data(), width, height);
             s_encoder->write_frame(s_flipped_buffer.data(), width, height);
+            if (s_hash_writer.is_open()) {
+                s_hash_writer.write(s_captured_frames,
+                                    frame_hash_compute(s_flipped_buffer.data(), width, height));
+            }
             s_captured_frames++;
             if (s_progress_callback) s_progress_callback(s_captured_frames, s_total_frames);
             return;
@@ -310,5 +408,6 @@ void frame_capture_callback(unsigned int frame_index) {
     glBindBuffer_fn(GL_PIXEL_PACK_BUFFER, 0);
 
     s_pbo_has_data = true;
+    s_submitted_frames++;
     s_pbo_index = 1 - s_pbo_index;
 }
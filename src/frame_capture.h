@@ -1,6 +1,7 @@
 #pragma once
 #include "emulator.h"
 #include "ffmpeg_encoder.h"
+#include <string>
 #include <functional>
 #include <atomic>
 
@@ -18,6 +19,16 @@ void frame_capture_set_progress_callback(ProgressCallback cb);
 // Set a cancel flag (checked each frame; stops emulation when set).
 void frame_capture_set_cancel_flag(std::atomic<bool>* flag);
 
+// Number of threads that flip each frame in row bands (0 = auto by resolution, 1 = single).
+void frame_capture_set_worker_threads(int threads);
+
+// Stop emulation once this many frames have been captured (0 = run the whole replay).
+void frame_capture_set_frame_limit(int frames);
+
+// Write a per-frame perceptual + exact hash sidecar to this path (empty = disabled).
+// Opened alongside the encoder on the first frame; call after frame_capture_init.
+void frame_capture_set_hash_output(const std::string& path);
+
 // The VI frame callback registered with the core.
 void frame_capture_callback(unsigned int frame_index);
 
@@ -26,3 +37,18 @@ void frame_capture_flush();
 
 // Get the number of frames captured so far.
 int frame_capture_count();
+
+// Number of frames read back so far, counted on the emulation thread ahead of
+// the encode thread. Used as the video clock for live audio.
+int frame_capture_submitted_count();
+
+struct FrameCaptureStats {
+    int frames = 0;            // frames handed to the encode thread
+    double wall_seconds = 0;   // capture start to flush
+    double wait_seconds = 0;   // emulation thread blocked in wait_for_encode()
+    int waits = 0;             // handoffs that found the encode thread still busy
+    double flip_seconds = 0;   // encode thread time spent flipping
+};
+
+// Pipeline timing for the current / last job (valid after frame_capture_flush).
+FrameCaptureStats frame_capture_stats();
@@ -0,0 +1,237 @@
+#include "frame_hash.h"
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRAME_HASH_SSE2 1
+#endif
+
+// Luma plane used for the perceptual hash: 64x64 samples, reduced to 8x8 blocks
+static const int LUMA_DIM = 64;
+static const int BLOCK_DIM = 8;
+
+// xxHash64 primes; the exact hash uses the same 4-lane round structure
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read_u64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t hash_merge(uint64_t acc, uint64_t lane) {
+    acc ^= hash_round(0, lane);
+    return acc * PRIME1 + PRIME4;
+}
+
+static uint64_t hash_bytes(const uint8_t* data, size_t len) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = PRIME1 + PRIME2;
+        uint64_t v2 = PRIME2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - PRIME1;
+        const uint8_t* limit = end - 32;
+        do {
+            v1 = hash_round(v1, read_u64(p));
+            v2 = hash_round(v2, read_u64(p + 8));
+            v3 = hash_round(v3, read_u64(p + 16));
+            v4 = hash_round(v4, read_u64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = hash_merge(h, v1);
+        h = hash_merge(h, v2);
+        h = hash_merge(h, v3);
+        h = hash_merge(h, v4);
+    } else {
+        h = PRIME5;
+    }
+
+    h += (uint64_t)len;
+    while (p + 8 <= end) {
+        h ^= hash_round(0, read_u64(p));
+        h = rotl64(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    while (p < end) {
+        h ^= (*p) * PRIME5;
+        h = rotl64(h, 11) * PRIME1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Point-sample the frame into a LUMA_DIM x LUMA_DIM BT.601 luma plane
+static void sample_luma(const uint8_t* rgb_data, int width, int height, uint8_t* luma) {
+    int stride = width * 3;
+    for (int y = 0; y < LUMA_DIM; y++) {
+        int sy = (int)(((2 * y + 1) * (int64_t)height) / (2 * LUMA_DIM));
+        const uint8_t* row = rgb_data + (size_t)sy * stride;
+        for (int x = 0; x < LUMA_DIM; x++) {
+            int sx = (int)(((2 * x + 1) * (int64_t)width) / (2 * LUMA_DIM));
+            const uint8_t* px = row + sx * 3;
+            luma[y * LUMA_DIM + x] = (uint8_t)((77 * px[0] + 150 * px[1] + 29 * px[2] + 128) >> 8);
+        }
+    }
+}
+
+// Sum each 8x8 block of the luma plane into block_sums[64]
+static void reduce_blocks(const uint8_t* luma, uint32_t* block_sums) {
+#ifdef FRAME_HASH_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (int by = 0; by < BLOCK_DIM; by++) {
+        // Each 16-byte load covers two adjacent 8-pixel block rows; PSADBW
+        // against zero yields the two 8-byte sums in the low/high qwords.
+        __m128i acc[4] = { zero, zero, zero, zero };
+        const uint8_t* base = luma + by * 8 * LUMA_DIM;
+        for (int r = 0; r < 8; r++) {
+            const uint8_t* row = base + r * LUMA_DIM;
+            for (int q = 0; q < 4; q++) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(row + q * 16));
+                acc[q] = _mm_add_epi64(acc[q], _mm_sad_epu8(v, zero));
+            }
+        }
+        for (int q = 0; q < 4; q++) {
+            block_sums[by * BLOCK_DIM + q * 2 + 0] = (uint32_t)_mm_cvtsi128_si32(acc[q]);
+            block_sums[by * BLOCK_DIM + q * 2 + 1] = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc[q], 8));
+        }
+    }
+#else
+    for (int by = 0; by < BLOCK_DIM; by++) {
+        for (int bx = 0; bx < BLOCK_DIM; bx++) {
+            uint32_t sum = 0;
+            for (int r = 0; r < 8; r++) {
+                const uint8_t* row = luma + (by * 8 + r) * LUMA_DIM + bx * 8;
+                for (int c = 0; c < 8; c++) sum += row[c];
+            }
+            block_sums[by * BLOCK_DIM + bx] = sum;
+        }
+    }
+#endif
+}
+
+FrameHash frame_hash_compute(const uint8_t* rgb_data, int width, int height) {
+    FrameHash result = {};
+    if (!rgb_data || width <= 0 || height <= 0) return result;
+
+    uint8_t luma[LUMA_DIM * LUMA_DIM];
+    uint32_t block_sums[BLOCK_DIM * BLOCK_DIM];
+    sample_luma(rgb_data, width, height, luma);
+    reduce_blocks(luma, block_sums);
+
+    uint64_t total = 0;
+    for (uint32_t s : block_sums) total += s;
+    uint64_t mean = total / (BLOCK_DIM * BLOCK_DIM);
+
+    uint64_t phash = 0;
+    for (int i = 0; i < BLOCK_DIM * BLOCK_DIM; i++) {
+        if (block_sums[i] > mean) phash |= 1ULL << i;
+    }
+
+    result.phash = phash;
+    result.exact = hash_bytes(rgb_data, (size_t)width * height * 3);
+    return result;
+}
+
+int frame_hash_distance(uint64_t a, uint64_t b) {
+    uint64_t x = a ^ b;
+    int count = 0;
+    while (x) {
+        x &= x - 1;
+        count++;
+    }
+    return count;
+}
+
+bool FrameHashWriter::open(const std::string& path, int width, int height, double fps) {
+    file = fopen(path.c_str(), "w");
+    if (!file) {
+        fprintf(stderr, "Error: cannot open frame hash file '%s'\n", path.c_str());
+        return false;
+    }
+    fprintf(file, "# krec2mp4-framehash v1 %dx%d %g\n", width, height, fps);
+    return true;
+}
+
+void FrameHashWriter::write(int frame_index, const FrameHash& hash) {
+    if (!file) return;
+    fprintf(file, "%d %016llx %016llx\n", frame_index,
+            (unsigned long long)hash.phash, (unsigned long long)hash.exact);
+}
+
+void FrameHashWriter::close() {
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+static bool load_hash_file(const std::string& path, std::vector<FrameHash>& out) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) {
+        fprintf(stderr, "Error: cannot open frame hash file '%s'\n", path.c_str());
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        int index = 0;
+        unsigned long long phash = 0, exact = 0;
+        if (sscanf(line, "%d %llx %llx", &index, &phash, &exact) != 3) continue;
+        if (index < 0) continue;
+        if ((size_t)index >= out.size()) out.resize(index + 1);
+        out[index].phash = phash;
+        out[index].exact = exact;
+    }
+    fclose(f);
+    return true;
+}
+
+bool frame_hash_compare(const std::string& path_a, const std::string& path_b,
+                        int threshold, FrameHashCompareResult& out) {
+    std::vector<FrameHash> a, b;
+    if (!load_hash_file(path_a, a) || !load_hash_file(path_b, b)) return false;
+
+    out = FrameHashCompareResult();
+    out.frames_a = (int)a.size();
+    out.frames_b = (int)b.size();
+
+    size_t common = a.size() < b.size() ? a.size() : b.size();
+    for (size_t i = 0; i < common; i++) {
+        if (out.first_exact_mismatch < 0 && a[i].exact != b[i].exact) {
+            out.first_exact_mismatch = (int)i;
+        }
+        int dist = frame_hash_distance(a[i].phash, b[i].phash);
+        if (dist > out.max_distance) out.max_distance = dist;
+        if (out.first_perceptual_mismatch < 0 && dist > threshold) {
+            out.first_perceptual_mismatch = (int)i;
+        }
+    }
+    return true;
+}
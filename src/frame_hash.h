@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Per-frame fingerprint written to the .framehash sidecar.
+struct FrameHash {
+    uint64_t phash;  // average hash of an 8x8 downscaled luma plane (perceptual)
+    uint64_t exact;  // 64-bit hash of the full RGB24 frame (bit-exact)
+};
+
+// Hash a top-down RGB24 frame. Cheap enough to run on the encode thread per frame.
+FrameHash frame_hash_compute(const uint8_t* rgb_data, int width, int height);
+
+// Number of differing bits between two perceptual hashes (0 = identical, 64 = inverted).
+int frame_hash_distance(uint64_t a, uint64_t b);
+
+// Writes one line per frame: "<index> <phash> <exact>" (hex), after a "#" header line.
+class FrameHashWriter {
+public:
+    bool open(const std::string& path, int width, int height, double fps);
+    void write(int frame_index, const FrameHash& hash);
+    void close();
+    bool is_open() const { return file != nullptr; }
+
+private:
+    FILE* file = nullptr;
+};
+
+struct FrameHashCompareResult {
+    int frames_a = 0;
+    int frames_b = 0;
+    int first_exact_mismatch = -1;       // -1 = all common frames identical
+    int first_perceptual_mismatch = -1;  // first frame with distance > threshold
+    int max_distance = 0;
+};
+
+// Compare two .framehash files. Returns false if either file cannot be read.
+bool frame_hash_compare(const std::string& path_a, const std::string& path_b,
+                        int threshold, FrameHashCompareResult& out);
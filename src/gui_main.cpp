@@ -969,9 +969,10 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR, int nCmdShow) {
     icc.dwICC = ICC_BAR_CLASSES | ICC_PROGRESS_CLASS | ICC_STANDARD_CLASSES;
     InitCommonControlsEx(&icc);
 
-    // Probe available encoders (tests GPU encoders against ffmpeg)
+    // Probe available encoders (tests GPU encoders against ffmpeg; cached per ffmpeg build)
     std::string exe_dir_init = get_exe_dir();
-    g_encoders = probe_available_encoders(exe_dir_init + "ffmpeg.exe");
+    g_encoders = probe_available_encoders(exe_dir_init + "ffmpeg.exe",
+                                          exe_dir_init + "encoder_probe.cache");
 
     // Create UI font
     g_font = CreateFontW(-14, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE,
@@ -3,6 +3,15 @@
 #include <cstring>
 #include <ctime>
 
+// Read a null-terminated string and advance past the null
+static std::string read_string(uint8_t*& scan, uint8_t* end) {
+    uint8_t* start = scan;
+    while (scan < end && *scan != 0) scan++;
+    std::string s((const char*)start, scan - start);
+    if (scan < end) scan++;
+    return s;
+}
+
 bool krec_parse(const std::string& path, KrecData& out) {
     FILE* f = fopen(path.c_str(), "rb");
     if (!f) {
@@ -81,6 +90,7 @@ bool krec_parse(const std::string& path, KrecData& out) {
     out.input_data.clear();
     out.total_input_frames = 0;
     out.delay_frames = 0;
+    out.events.clear();
 
     int bytes_per_frame = num_players * 4;
     bool in_delay = true; // Track initial delay period
@@ -113,15 +123,15 @@ bool krec_parse(const std::string& path, KrecData& out) {
             out.total_input_frames++;
         } else if (type == 0x14) {
             // Drop: null-terminated nick + 4 bytes player number
-            while (scan < end && *scan != 0) scan++;
-            if (scan < end) scan++; // skip null
+            KrecEvent ev{KrecEvent::Drop, out.total_input_frames, read_string(scan, end), ""};
             scan += 4; // player number
+            out.events.push_back(ev);
         } else if (type == 0x08) {
-            // Chat: two null-terminated strings
-            while (scan < end && *scan != 0) scan++;
-            if (scan < end) scan++;
-            while (scan < end && *scan != 0) scan++;
-            if (scan < end) scan++;
+            // Chat: two null-terminated strings (nick, message)
+            KrecEvent ev{KrecEvent::Chat, out.total_input_frames, "", ""};
+            ev.nick = read_string(scan, end);
+            ev.text = read_string(scan, end);
+            out.events.push_back(ev);
         } else {
             break; // unknown record type
         }
@@ -159,4 +169,11 @@ void krec_print_info(const KrecData& data, double fps) {
     int total_sec = (int)(data.total_input_frames / fps);
     printf("Duration:  %d:%02d (at %.0f fps)\n", total_sec / 60, total_sec % 60, fps);
     printf("Input data: %zu bytes\n", data.input_data.size());
+
+    int chats = 0;
+    int drops = 0;
+    for (const auto& ev : data.events) (ev.type == KrecEvent::Chat ? chats : drops)++;
+    if (chats > 0 || drops > 0) {
+        printf("Events:    %d chat, %d drop\n", chats, drops);
+    }
 }
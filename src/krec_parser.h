@@ -13,12 +13,22 @@ struct KrecHeader {
     char player_names[4][32];
 };
 
+// Chat message or player drop recorded between input frames
+struct KrecEvent {
+    enum Type { Chat, Drop };
+    Type type;
+    int frame;         // input frames recorded before the event
+    std::string nick;
+    std::string text;  // chat message (empty for drops)
+};
+
 struct KrecData {
     KrecHeader header;
     // Flat array of input frames. Each frame is num_players * 4 bytes.
     std::vector<uint8_t> input_data;
     int total_input_frames;
     int delay_frames;  // Number of initial 0-length records (kaillera frame delay)
+    std::vector<KrecEvent> events;
 };
 
 // Parse a .krec file into KrecData. Returns true on success.
@@ -0,0 +1,239 @@
+#include "libav_encoder.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef KREC2MP4_HAVE_LIBAV
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+struct LibavState {
+    AVFormatContext* fmt = nullptr;
+    AVCodecContext* codec = nullptr;
+    AVStream* stream = nullptr;
+    SwsContext* sws = nullptr;
+    AVFrame* src_frame = nullptr;   // wraps the caller's RGB24 buffer, no copy
+    AVFrame* enc_frame = nullptr;   // encoder pixel format, owned
+    AVPacket* packet = nullptr;
+    int64_t next_pts = 0;
+};
+
+bool libav_backend_available() {
+    return true;
+}
+
+static void log_av_error(const char* what, int err) {
+    char buf[AV_ERROR_MAX_STRING_SIZE] = {};
+    av_strerror(err, buf, sizeof(buf));
+    fprintf(stderr, "Error: %s failed: %s\n", what, buf);
+}
+
+// Split ffmpeg_encoder_flags() output into codec name, pixel format and
+// encoder private options so both backends share one set of tuning flags.
+static void parse_encoder_flags(const std::string& flags, std::string& codec,
+                                std::string& pix_fmt, AVDictionary** opts) {
+    std::vector<std::string> tokens;
+    size_t pos = 0;
+    while (pos < flags.size()) {
+        size_t start = flags.find_first_not_of(' ', pos);
+        if (start == std::string::npos) break;
+        size_t end = flags.find(' ', start);
+        if (end == std::string::npos) end = flags.size();
+        tokens.push_back(flags.substr(start, end - start));
+        pos = end;
+    }
+
+    for (size_t i = 0; i + 1 < tokens.size(); i++) {
+        const std::string& key = tokens[i];
+        if (key.empty() || key[0] != '-') continue;
+        const std::string& value = tokens[++i];
+        if (key == "-c:v") {
+            codec = value;
+        } else if (key == "-pix_fmt") {
+            pix_fmt = value;
+        } else {
+            av_dict_set(opts, key.c_str() + 1, value.c_str(), 0);
+        }
+    }
+}
+
+// Drain every packet the encoder has ready into the muxer
+static bool drain_packets(LibavState* s) {
+    while (true) {
+        int ret = avcodec_receive_packet(s->codec, s->packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return true;
+        if (ret < 0) {
+            log_av_error("avcodec_receive_packet", ret);
+            return false;
+        }
+        av_packet_rescale_ts(s->packet, s->codec->time_base, s->stream->time_base);
+        s->packet->stream_index = s->stream->index;
+        ret = av_interleaved_write_frame(s->fmt, s->packet);
+        if (ret < 0) {
+            log_av_error("av_interleaved_write_frame", ret);
+            return false;
+        }
+    }
+}
+
+static void free_state(LibavState* s) {
+    if (!s) return;
+    if (s->fmt && !(s->fmt->oformat->flags & AVFMT_NOFILE)) avio_closep(&s->fmt->pb);
+    avformat_free_context(s->fmt);
+    avcodec_free_context(&s->codec);
+    sws_freeContext(s->sws);
+    av_frame_free(&s->src_frame);
+    av_frame_free(&s->enc_frame);
+    av_packet_free(&s->packet);
+    delete s;
+}
+
+LibavState* libav_open(const FFmpegConfig& config) {
+    std::string codec_name = "libx264";
+    std::string pix_fmt_name = "yuv420p";
+    AVDictionary* opts = nullptr;
+    parse_encoder_flags(ffmpeg_encoder_flags(config), codec_name, pix_fmt_name, &opts);
+
+    const AVCodec* codec = avcodec_find_encoder_by_name(codec_name.c_str());
+    if (!codec) {
+        fprintf(stderr, "Error: libavcodec has no encoder '%s'\n", codec_name.c_str());
+        av_dict_free(&opts);
+        return nullptr;
+    }
+
+    LibavState* s = new LibavState();
+    int ret = avformat_alloc_output_context2(&s->fmt, nullptr, nullptr, config.output_path.c_str());
+    if (ret < 0 || !s->fmt) {
+        log_av_error("avformat_alloc_output_context2", ret);
+        av_dict_free(&opts);
+        free_state(s);
+        return nullptr;
+    }
+
+    // Upscaling (native render) happens in the same swscale pass as the pixel format conversion
+    int out_width = config.scale_width > 0 ? config.scale_width : config.width;
+    int out_height = config.scale_height > 0 ? config.scale_height : config.height;
+    int sws_flags = config.scale_width <= 0 ? SWS_BILINEAR
+                  : config.scale_flags == "neighbor" ? SWS_POINT : SWS_LANCZOS;
+
+    AVRational frame_rate = av_d2q(config.fps, 100000);
+    s->codec = avcodec_alloc_context3(codec);
+    s->codec->width = out_width;
+    s->codec->height = out_height;
+    s->codec->pix_fmt = av_get_pix_fmt(pix_fmt_name.c_str());
+    s->codec->time_base = av_inv_q(frame_rate);
+    s->codec->framerate = frame_rate;
+    if (s->fmt->oformat->flags & AVFMT_GLOBALHEADER) {
+        s->codec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    ret = avcodec_open2(s->codec, codec, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        log_av_error("avcodec_open2", ret);
+        free_state(s);
+        return nullptr;
+    }
+
+    s->stream = avformat_new_stream(s->fmt, nullptr);
+    if (!s->stream) {
+        fprintf(stderr, "Error: avformat_new_stream failed\n");
+        free_state(s);
+        return nullptr;
+    }
+    avcodec_parameters_from_context(s->stream->codecpar, s->codec);
+    s->stream->time_base = s->codec->time_base;
+
+    if (!(s->fmt->oformat->flags & AVFMT_NOFILE)) {
+        ret = avio_open(&s->fmt->pb, config.output_path.c_str(), AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            log_av_error("avio_open", ret);
+            free_state(s);
+            return nullptr;
+        }
+    }
+    ret = avformat_write_header(s->fmt, nullptr);
+    if (ret < 0) {
+        log_av_error("avformat_write_header", ret);
+        free_state(s);
+        return nullptr;
+    }
+
+    s->sws = sws_getContext(config.width, config.height, AV_PIX_FMT_RGB24,
+                            out_width, out_height, s->codec->pix_fmt,
+                            sws_flags, nullptr, nullptr, nullptr);
+    s->src_frame = av_frame_alloc();
+    s->enc_frame = av_frame_alloc();
+    s->packet = av_packet_alloc();
+    s->enc_frame->format = s->codec->pix_fmt;
+    s->enc_frame->width = out_width;
+    s->enc_frame->height = out_height;
+    if (!s->sws || !s->src_frame || !s->packet || av_frame_get_buffer(s->enc_frame, 0) < 0) {
+        fprintf(stderr, "Error: failed to allocate libav frame state\n");
+        free_state(s);
+        return nullptr;
+    }
+
+    fprintf(stderr, "libav encoder: %s %dx%d @ %g fps -> %s\n", codec_name.c_str(),
+            out_width, out_height, config.fps, config.output_path.c_str());
+    return s;
+}
+
+bool libav_write_frame(LibavState* s, const uint8_t* rgb_data, int width, int height) {
+    if (!s) return false;
+
+    // Point the source frame at the caller's buffer instead of copying it
+    s->src_frame->format = AV_PIX_FMT_RGB24;
+    s->src_frame->width = width;
+    s->src_frame->height = height;
+    s->src_frame->data[0] = const_cast<uint8_t*>(rgb_data);
+    s->src_frame->linesize[0] = width * 3;
+
+    // The encoder may still hold a reference to the previous frame's buffer
+    if (av_frame_make_writable(s->enc_frame) < 0) return false;
+    sws_scale(s->sws, s->src_frame->data, s->src_frame->linesize, 0, height,
+              s->enc_frame->data, s->enc_frame->linesize);
+    s->enc_frame->pts = s->next_pts++;
+
+    int ret = avcodec_send_frame(s->codec, s->enc_frame);
+    if (ret < 0) {
+        log_av_error("avcodec_send_frame", ret);
+        return false;
+    }
+    return drain_packets(s);
+}
+
+void libav_close(LibavState* s) {
+    if (!s) return;
+    avcodec_send_frame(s->codec, nullptr);
+    drain_packets(s);
+    av_write_trailer(s->fmt);
+    free_state(s);
+}
+
+#else
+
+bool libav_backend_available() {
+    return false;
+}
+
+LibavState* libav_open(const FFmpegConfig&) {
+    fprintf(stderr, "Error: libav encoder backend not built (configure with -DKREC2MP4_LIBAV=ON)\n");
+    return nullptr;
+}
+
+bool libav_write_frame(LibavState*, const uint8_t*, int, int) {
+    return false;
+}
+
+void libav_close(LibavState*) {}
+
+#endif
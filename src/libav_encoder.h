@@ -0,0 +1,11 @@
+#pragma once
+#include "ffmpeg_encoder.h"
+
+// In-process encoder backend (EncoderBackend::Libav). Frames are wrapped as
+// AVFrames in place, converted to the encoder's pixel format with swscale and
+// written straight to the container, with no ffmpeg child process or pipe.
+// Without KREC2MP4_LIBAV these are stubs and libav_open() always fails.
+
+LibavState* libav_open(const FFmpegConfig& config);
+bool libav_write_frame(LibavState* state, const uint8_t* rgb_data, int width, int height);
+void libav_close(LibavState* state);
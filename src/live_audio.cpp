@@ -0,0 +1,104 @@
+#include "live_audio.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Drift beyond this (in output samples) is fixed at once with silence or a drop
+static const double HARD_RESYNC_SAMPLES = LIVE_AUDIO_RATE / 10.0;  // 100 ms
+
+// Small drift is absorbed by trimming the resample ratio, at most this much
+static const double MAX_RATE_TRIM = 0.005;
+
+// Ratio trim per sample of (smoothed) drift, and the drift smoothing factor
+static const double TRIM_GAIN = 1.0 / (LIVE_AUDIO_RATE * 4.0);
+static const double DRIFT_SMOOTHING = 0.02;
+
+static FFmpegEncoder* s_encoder = nullptr;
+static double s_fps = 60.0;
+static std::function<int()> s_video_frames;
+static LiveAudioStats s_stats;
+// Output samples produced, written or not: the resampler's clock against video
+static unsigned long long s_produced = 0;
+
+// Resampler state: s_pos is the next output position in input samples,
+// relative to s_prev (the last sample of the previous chunk).
+static int16_t s_prev[2] = {0, 0};
+static double s_pos = 0;
+static double s_drift_avg = 0;
+static std::vector<int16_t> s_out;
+
+void live_audio_init(FFmpegEncoder* encoder, double fps, std::function<int()> video_frames) {
+    s_encoder = encoder;
+    s_fps = fps > 0 ? fps : 60.0;
+    s_video_frames = std::move(video_frames);
+    s_stats = LiveAudioStats();
+    s_produced = 0;
+    s_prev[0] = s_prev[1] = 0;
+    s_pos = 0;
+    s_drift_avg = 0;
+}
+
+LiveAudioStats live_audio_stats() {
+    return s_stats;
+}
+
+static void write_out(size_t samples) {
+    s_produced += samples;
+    if (s_encoder->write_audio((const uint8_t*)s_out.data(), samples * 4)) {
+        s_stats.samples_out += samples;
+    } else {
+        s_stats.samples_failed += samples;
+        s_stats.write_failures++;
+    }
+}
+
+void live_audio_callback(const void* pcm, unsigned int bytes, unsigned int frequency, void* /*context*/) {
+    if (!s_encoder || frequency == 0) return;
+
+    const int16_t* in = (const int16_t*)pcm;
+    unsigned int n_in = bytes / 4;
+    if (n_in == 0) return;
+    s_stats.samples_in += n_in;
+
+    int frames = s_video_frames ? s_video_frames() : 0;
+    double target = frames * (double)LIVE_AUDIO_RATE / s_fps;
+    double drift = (double)s_produced - target; // > 0: audio ahead of video
+
+    if (drift < -HARD_RESYNC_SAMPLES) {
+        // Audio fell behind (e.g. AI idle during boot): pad with silence
+        size_t pad = (size_t)(-drift);
+        s_out.assign(pad * 2, 0);
+        write_out(pad);
+        s_stats.silence_inserted += pad;
+        drift = 0;
+        s_drift_avg = 0;
+    } else if (drift > HARD_RESYNC_SAMPLES) {
+        // Audio ran ahead (e.g. produced before the first video frame): drop it
+        s_stats.samples_dropped += n_in;
+        s_prev[0] = in[(n_in - 1) * 2];
+        s_prev[1] = in[(n_in - 1) * 2 + 1];
+        return;
+    }
+
+    s_drift_avg += (drift - s_drift_avg) * DRIFT_SMOOTHING;
+    double trim = std::clamp(s_drift_avg * TRIM_GAIN, -MAX_RATE_TRIM, MAX_RATE_TRIM);
+    double step = (double)frequency / LIVE_AUDIO_RATE * (1.0 + trim);
+
+    // Linear interpolation between input samples idx-1 and idx
+    s_out.clear();
+    while (s_pos < n_in) {
+        unsigned int idx = (unsigned int)s_pos;
+        double frac = s_pos - idx;
+        const int16_t* a = idx == 0 ? s_prev : in + (idx - 1) * 2;
+        const int16_t* b = in + idx * 2;
+        s_out.push_back((int16_t)(a[0] + (b[0] - a[0]) * frac));
+        s_out.push_back((int16_t)(a[1] + (b[1] - a[1]) * frac));
+        s_pos += step;
+    }
+    s_pos -= n_in;
+    s_prev[0] = in[(n_in - 1) * 2];
+    s_prev[1] = in[(n_in - 1) * 2 + 1];
+
+    if (!s_out.empty()) write_out(s_out.size() / 2);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "ffmpeg_encoder.h"
+#include <functional>
+
+// Sample rate of the live audio stream handed to the encoder.
+const unsigned int LIVE_AUDIO_RATE = 48000;
+
+struct LiveAudioStats {
+    unsigned long long samples_in = 0;        // stereo samples received from the plugin
+    unsigned long long samples_out = 0;       // stereo samples written to the encoder
+    unsigned long long silence_inserted = 0;  // output samples padded to catch up with video
+    unsigned long long samples_dropped = 0;   // input samples discarded while ahead of video
+    unsigned long long samples_failed = 0;    // output samples the encoder refused (not in samples_out)
+    unsigned long long write_failures = 0;    // failed encoder writes
+};
+
+// Resamples captured N64 audio to LIVE_AUDIO_RATE and writes it to the encoder's
+// live audio input. The resample ratio is trimmed to stay locked to the video
+// frame clock, so frame N and audio sample N * rate / fps share a timestamp.
+// video_frames returns the number of video frames submitted so far.
+void live_audio_init(FFmpegEncoder* encoder, double fps, std::function<int()> video_frames);
+
+// audio_capture_callback-compatible sink; register with audio_capture_set_callback.
+void live_audio_callback(const void* pcm, unsigned int bytes, unsigned int frequency, void* context);
+
+LiveAudioStats live_audio_stats();
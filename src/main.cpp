@@ -1,7 +1,11 @@
 #include "converter.h"
+#include "frame_hash.h"
+#include "transcode_queue.h"
+#include "output_flusher.h"
 
 #include <cstdio>
 #include <cstring>
+#include <set>
 #include <string>
 #include <vector>
 #include <filesystem>
@@ -9,11 +13,21 @@
 namespace fs = std::filesystem;
 
 static void print_usage(const char* prog) {
-    printf("Usage: %s [options] <input.krec>\n\n", prog);
+    printf("Usage: %s [options] <input.krec>\n", prog);
+    printf("       %s --transcode-queue <dir> [--watch] [--ffmpeg <path>]\n", prog);
+    printf("       %s --compare-hashes <a.framehash> <b.framehash>\n\n", prog);
     printf("Convert N64 Kaillera replay recordings (.krec) to MP4 video.\n\n");
     printf("Options:\n");
     printf("  --rom <path>          N64 ROM file (required)\n");
-    printf("  --output <path>       Output .mp4 file (default: <input>.mp4)\n");
+    printf("  --output <path>       Output .mp4 file (default: <input>.mp4), - for stdout\n");
+    printf("  --extra-output <spec> Also encode <path>[,encoder=c][,crf=n][,preset=p][,height=h|,res=WxH]\n");
+    printf("                        from the same run (repeatable; {stem} = input name)\n");
+    printf("  --format <fmt>        Container: fmp4 or mpegts (streamable; default for -),\n");
+    printf("                        hls or dash (segmented ABR package, output .m3u8/.mpd)\n");
+    printf("  --ladder <spec>       hls/dash renditions: <height>[:<kbps>],... (e.g. 1440,720,360)\n");
+    printf("  --segment-minutes <n> Roll the output into <name>_NNN segments of n minutes,\n");
+    printf("                        each finished as soon as it is complete (+ .segments.csv index)\n");
+    printf("  --segment-markers     Also start a new segment at chat and drop events\n");
     printf("  --batch               Process all .krec files in <input> directory\n");
     printf("  --core <path>         mupen64plus core DLL (default: ./Core/mupen64plus.dll)\n");
     printf("  --plugin-dir <path>   Plugin directory (default: ./Plugin/)\n");
@@ -22,6 +36,37 @@ static void print_usage(const char* prog) {
     printf("  --fps <value>         Override framerate (default: 60 NTSC / 50 PAL)\n");
     printf("  --resolution <WxH>    Output resolution (default: 640x480)\n");
     printf("  --crf <int>           H.264 quality, lower=better (default: 23)\n");
+    printf("  --encoder <codec>     Video encoder: libx264, libx265, libsvtav1, libvpx-vp9,\n");
+    printf("                        h264_nvenc, ... (default: libx264)\n");
+    printf("  --preset <name>       Encoder speed preset (e.g. veryfast, p4; default per encoder)\n");
+    printf("  --encoder-threads <n> CPU encoder threads (default: encoder decides)\n");
+    printf("  --auto-tune           Pick preset/threads by trial encodes (cached per game)\n");
+    printf("  --tune-ssim <value>   Auto-tune quality bar, SSIM 0-1 (default: 0.98)\n");
+    printf("  --capture-lossless    Write a lossless <output>.capture.mkv and queue the encode\n");
+    printf("  --lossless-codec <c>  Lossless capture codec: utvideo or ffv1 (default: utvideo)\n");
+    printf("  --queue-dir <dir>     Transcode queue for --capture-lossless (default: output dir)\n");
+    printf("  --scratch-dir <dir>   Write outputs and temp files on fast local storage and move\n");
+    printf("                        finished files to the output dir in the background\n");
+    printf("  --flush-jobs <n>      Concurrent moves out of --scratch-dir (default: 2)\n");
+    printf("  --transcode-queue <d> Encode queued lossless captures in <d> to their outputs\n");
+    printf("  --watch               With --transcode-queue, keep waiting for new jobs\n");
+    printf("  --encode-workers <n>  Encode keyframe-aligned chunks in n parallel ffmpeg processes\n");
+    printf("  --chunk-frames <n>    Frames per chunk for --encode-workers (default: auto)\n");
+    printf("  --target-size <MB>    Fit the output in this size (bitrate mode; exact two-pass\n");
+    printf("                        with --capture-lossless)\n");
+    printf("  --native-render <f>   Render at N64 native 320x240 and let the encoder upscale to\n");
+    printf("                        --resolution with filter f: neighbor (integer sizes) or lanczos\n");
+    printf("  --backend <name>      Encoder backend: pipe (ffmpeg process), libav (in-process) or\n");
+    printf("                        y4m (raw YUV4MPEG2 to a file, FIFO or - for an external encoder)\n");
+    printf("  --audio-output <path> y4m backend: audio sink, WAV for .wav else raw s16le stereo\n");
+    printf("                        (default: <output>.wav; required for stream outputs)\n");
+    printf("  --two-pass-audio      Capture audio to a temp file and mux after encoding\n");
+    printf("  --capture-threads <n> Threads for per-frame flip (default: auto by resolution)\n");
+    printf("  --unbatched-writes    Send every frame to ffmpeg in its own write (batching small\n");
+    printf("                        frames is the default; compare the Pipe writes summary)\n");
+    printf("  --recover             If ffmpeg crashes, continue in a new segment and join them at\n");
+    printf("                        the end (.mp4 outputs are then written as fragmented MP4)\n");
+    printf("  --frame-hash          Write per-frame hashes to <output>.framehash\n");
     printf("  --verbose             Verbose logging\n");
     printf("  --help                Show this help\n");
 }
@@ -39,6 +84,37 @@ static bool parse_args(int argc, char* argv[], AppConfig& config) {
             config.rom_path = argv[++i];
         } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
             config.output_path = argv[++i];
+        } else if (strcmp(argv[i], "--extra-output") == 0 && i + 1 < argc) {
+            FFmpegOutput out;
+            if (!parse_output_spec(argv[++i], out)) {
+                fprintf(stderr, "Error: invalid output spec '%s'\n", argv[i]);
+                return false;
+            }
+            if (!find_encoder_info(out.encoder)) {
+                fprintf(stderr, "Error: unknown encoder '%s'\n", out.encoder.c_str());
+                return false;
+            }
+            config.extra_outputs.push_back(out);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            config.output_format = argv[++i];
+            if (config.output_format != "fmp4" && config.output_format != "mpegts" &&
+                !is_package_format(config.output_format)) {
+                fprintf(stderr, "Error: unknown format '%s' (expected fmp4, mpegts, hls or dash)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--ladder") == 0 && i + 1 < argc) {
+            if (!parse_ladder_spec(argv[++i], config.ladder)) {
+                fprintf(stderr, "Error: invalid ladder '%s' (expected <height>[:<kbps>],...)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--segment-minutes") == 0 && i + 1 < argc) {
+            config.segment_minutes = atof(argv[++i]);
+            if (config.segment_minutes <= 0) {
+                fprintf(stderr, "Error: invalid segment length '%s' (expected minutes > 0)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--segment-markers") == 0) {
+            config.segment_markers = true;
         } else if (strcmp(argv[i], "--batch") == 0) {
             config.batch = true;
         } else if (strcmp(argv[i], "--core") == 0 && i + 1 < argc) {
@@ -58,6 +134,83 @@ static bool parse_args(int argc, char* argv[], AppConfig& config) {
             }
         } else if (strcmp(argv[i], "--crf") == 0 && i + 1 < argc) {
             config.crf = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--encoder") == 0 && i + 1 < argc) {
+            config.encoder = argv[++i];
+            if (!find_encoder_info(config.encoder)) {
+                fprintf(stderr, "Error: unknown encoder '%s'\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--preset") == 0 && i + 1 < argc) {
+            config.preset = argv[++i];
+        } else if (strcmp(argv[i], "--encoder-threads") == 0 && i + 1 < argc) {
+            config.encoder_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--auto-tune") == 0) {
+            config.auto_tune = true;
+        } else if (strcmp(argv[i], "--tune-ssim") == 0 && i + 1 < argc) {
+            config.tune_min_ssim = atof(argv[++i]);
+            if (config.tune_min_ssim <= 0 || config.tune_min_ssim > 1) {
+                fprintf(stderr, "Error: invalid SSIM target '%s' (expected 0-1)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--capture-lossless") == 0) {
+            config.capture_lossless = true;
+        } else if (strcmp(argv[i], "--lossless-codec") == 0 && i + 1 < argc) {
+            config.lossless_codec = argv[++i];
+            if (config.lossless_codec != "utvideo" && config.lossless_codec != "ffv1") {
+                fprintf(stderr, "Error: unknown lossless codec '%s' (expected utvideo or ffv1)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--queue-dir") == 0 && i + 1 < argc) {
+            config.queue_dir = argv[++i];
+        } else if (strcmp(argv[i], "--scratch-dir") == 0 && i + 1 < argc) {
+            config.scratch_dir = argv[++i];
+        } else if (strcmp(argv[i], "--flush-jobs") == 0 && i + 1 < argc) {
+            config.flush_jobs = atoi(argv[++i]);
+            if (config.flush_jobs < 1) {
+                fprintf(stderr, "Error: invalid flush job count '%s'\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--transcode-queue") == 0 && i + 1 < argc) {
+            config.transcode_queue = argv[++i];
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            config.queue_watch = true;
+        } else if (strcmp(argv[i], "--encode-workers") == 0 && i + 1 < argc) {
+            config.encode_workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--chunk-frames") == 0 && i + 1 < argc) {
+            config.chunk_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--target-size") == 0 && i + 1 < argc) {
+            config.target_size_mb = atof(argv[++i]);
+            if (config.target_size_mb <= 0) {
+                fprintf(stderr, "Error: invalid target size '%s' (expected MB > 0)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            if (!parse_encoder_backend(argv[++i], config.backend)) {
+                fprintf(stderr, "Error: unknown backend '%s' (expected pipe, libav or y4m)\n", argv[i]);
+                return false;
+            }
+            if (config.backend == EncoderBackend::Libav && !libav_backend_available()) {
+                fprintf(stderr, "Error: this build has no libav backend (configure with -DKREC2MP4_LIBAV=ON)\n");
+                return false;
+            }
+        } else if (strcmp(argv[i], "--native-render") == 0 && i + 1 < argc) {
+            config.native_render = argv[++i];
+            if (config.native_render != "neighbor" && config.native_render != "lanczos") {
+                fprintf(stderr, "Error: unknown upscale filter '%s' (expected neighbor or lanczos)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--audio-output") == 0 && i + 1 < argc) {
+            config.audio_output = argv[++i];
+        } else if (strcmp(argv[i], "--two-pass-audio") == 0) {
+            config.live_audio = false;
+        } else if (strcmp(argv[i], "--capture-threads") == 0 && i + 1 < argc) {
+            config.capture_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--unbatched-writes") == 0) {
+            config.batch_writes = false;
+        } else if (strcmp(argv[i], "--recover") == 0) {
+            config.recover = true;
+        } else if (strcmp(argv[i], "--frame-hash") == 0) {
+            config.frame_hash = true;
         } else if (strcmp(argv[i], "--verbose") == 0) {
             config.verbose = true;
         } else if (argv[i][0] == '-') {
@@ -68,6 +221,9 @@ static bool parse_args(int argc, char* argv[], AppConfig& config) {
         }
     }
 
+    // Transcode worker mode needs no ROM or replay
+    if (!config.transcode_queue.empty()) return true;
+
     if (config.rom_path.empty()) {
         fprintf(stderr, "Error: --rom is required\n");
         return false;
@@ -76,13 +232,155 @@ static bool parse_args(int argc, char* argv[], AppConfig& config) {
         fprintf(stderr, "Error: input .krec file or directory is required\n");
         return false;
     }
+    if (config.encode_workers > 1 &&
+        (config.backend != EncoderBackend::Pipe || !config.extra_outputs.empty() ||
+         is_stream_output(config.output_path))) {
+        fprintf(stderr, "Error: --encode-workers needs the pipe backend, a file output and no --extra-output\n");
+        return false;
+    }
+    if (!config.extra_outputs.empty()) {
+        if (config.backend != EncoderBackend::Pipe) {
+            fprintf(stderr, "Error: --extra-output requires the pipe backend\n");
+            return false;
+        }
+        for (const auto& out : config.extra_outputs) {
+            if (config.batch && out.path.find("{stem}") == std::string::npos) {
+                fprintf(stderr, "Error: --extra-output path needs {stem} with --batch\n");
+                return false;
+            }
+        }
+    }
+    if (config.backend == EncoderBackend::Y4M) {
+        if (!config.output_format.empty() && config.output_format != "y4m") {
+            fprintf(stderr, "Error: the y4m backend writes only Y4M (no --format)\n");
+            return false;
+        }
+        if (config.capture_lossless || config.auto_tune || config.target_size_mb > 0 ||
+            !config.extra_outputs.empty() || !config.native_render.empty()) {
+            fprintf(stderr, "Error: the y4m backend cannot be combined with --capture-lossless, "
+                            "--auto-tune, --target-size, --extra-output or --native-render\n");
+            return false;
+        }
+        config.output_format = "y4m";
+    } else if (!config.audio_output.empty()) {
+        fprintf(stderr, "Error: --audio-output needs --backend y4m\n");
+        return false;
+    }
+    if (!config.ladder.empty() && !is_package_format(config.output_format)) {
+        fprintf(stderr, "Error: --ladder needs --format hls or dash\n");
+        return false;
+    }
+    if (is_package_format(config.output_format)) {
+        if (config.backend != EncoderBackend::Pipe || is_stream_output(config.output_path)) {
+            fprintf(stderr, "Error: --format %s needs the pipe backend and a file output\n",
+                    config.output_format.c_str());
+            return false;
+        }
+        if (config.capture_lossless || !config.extra_outputs.empty() || config.encode_workers > 1 ||
+            config.target_size_mb > 0) {
+            fprintf(stderr, "Error: --format %s cannot be combined with --capture-lossless, "
+                            "--extra-output, --encode-workers or --target-size\n",
+                    config.output_format.c_str());
+            return false;
+        }
+    }
+    if (config.segment_minutes > 0 || config.segment_markers) {
+        if (config.backend != EncoderBackend::Pipe || is_stream_output(config.output_path) ||
+            !config.output_format.empty()) {
+            fprintf(stderr, "Error: segmented output needs the pipe backend, a file output and no --format\n");
+            return false;
+        }
+        if (config.capture_lossless || config.encode_workers > 1 || config.target_size_mb > 0) {
+            fprintf(stderr, "Error: segmented output cannot be combined with --capture-lossless, "
+                            "--encode-workers or --target-size\n");
+            return false;
+        }
+    }
+    if (config.recover &&
+        (config.backend != EncoderBackend::Pipe || is_stream_output(config.output_path) ||
+         is_package_format(config.output_format) || config.segment_minutes > 0 || config.segment_markers ||
+         config.encode_workers > 1 || !config.extra_outputs.empty())) {
+        fprintf(stderr, "Error: --recover needs the pipe backend and a single file output "
+                        "(no --format hls/dash, segments, --encode-workers or --extra-output)\n");
+        return false;
+    }
+    if (is_stream_output(config.output_path)) {
+#ifdef _WIN32
+        // A CRT fd number means nothing in the ffmpeg child; only stdout is handed over
+        if (config.output_path != "-") {
+            fprintf(stderr, "Error: pipe:N outputs are not supported on Windows, use -\n");
+            return false;
+        }
+#endif
+        if (config.batch) {
+            fprintf(stderr, "Error: --batch cannot write to a stream output\n");
+            return false;
+        }
+        if (config.backend == EncoderBackend::Libav) {
+            fprintf(stderr, "Error: stream outputs require the pipe or y4m backend\n");
+            return false;
+        }
+        if (config.capture_lossless) {
+            fprintf(stderr, "Error: --capture-lossless cannot write to a stream output\n");
+            return false;
+        }
+        if (config.frame_hash) {
+            fprintf(stderr, "Error: --frame-hash writes a file next to the output, not a stream output\n");
+            return false;
+        }
+    }
 
     return true;
 }
 
+// Report the first frame where two .framehash files diverge. Returns 0 if identical.
+static int compare_hashes(const char* path_a, const char* path_b) {
+    const int threshold = 4; // max perceptual hash bit distance for "near-duplicate"
+
+    FrameHashCompareResult result;
+    if (!frame_hash_compare(path_a, path_b, threshold, result)) return 2;
+
+    printf("Frames: %d vs %d\n", result.frames_a, result.frames_b);
+    if (result.first_exact_mismatch >= 0) {
+        printf("First exact mismatch:      frame %d\n", result.first_exact_mismatch);
+    }
+    if (result.first_perceptual_mismatch >= 0) {
+        printf("First perceptual mismatch: frame %d (distance > %d)\n",
+               result.first_perceptual_mismatch, threshold);
+    }
+    printf("Max perceptual distance:   %d\n", result.max_distance);
+
+    if (result.first_exact_mismatch < 0 && result.frames_a == result.frames_b) {
+        printf("Identical.\n");
+        return 0;
+    }
+    if (result.first_exact_mismatch < 0) {
+        printf("Common frames identical; frame counts differ.\n");
+    }
+    return 1;
+}
+
+// "--output -" streams the video to stdout, so our own output must move to stderr
+// before anything is printed.
+static bool wants_stdout_stream(int argc, char* argv[]) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--output") == 0 && strcmp(argv[i + 1], "-") == 0) return true;
+    }
+    return false;
+}
+
 int main(int argc, char* argv[]) {
+    if (wants_stdout_stream(argc, argv) && !ffmpeg_reserve_stdout()) {
+        fprintf(stderr, "Error: cannot reserve stdout for stream output\n");
+        return 1;
+    }
+
     printf("Krec2MP4 - N64 Kaillera Replay to Video Converter\n\n");
 
+    if (argc == 4 && strcmp(argv[1], "--compare-hashes") == 0) {
+        return compare_hashes(argv[2], argv[3]);
+    }
+
     // Set defaults relative to exe location
     std::string exe_dir = get_exe_dir();
 
@@ -99,7 +397,44 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    if (!check_ffmpeg(config.ffmpeg_path)) return 1;
+    // The y4m backend writes its stream itself; everything else runs ffmpeg
+    bool y4m_only = config.backend == EncoderBackend::Y4M && config.transcode_queue.empty();
+    if (!y4m_only && !check_ffmpeg(config.ffmpeg_path)) return 1;
+
+    if (!config.transcode_queue.empty()) {
+        if (!fs::is_directory(config.transcode_queue)) {
+            fprintf(stderr, "Error: '%s' is not a directory\n", config.transcode_queue.c_str());
+            return 1;
+        }
+        return transcode_queue_run(config.transcode_queue, config.ffmpeg_path,
+                                   config.queue_watch) > 0 ? 1 : 0;
+    }
+
+    // Hardware encoders must have passed a probe against this ffmpeg build
+    std::vector<std::string> codecs;
+    if (!y4m_only) codecs.push_back(config.encoder);
+    for (const auto& out : config.extra_outputs) codecs.push_back(out.encoder);
+    std::vector<EncoderInfo> available;
+    bool probed = false;
+    for (const std::string& codec : codecs) {
+        const EncoderInfo* encoder_info = find_encoder_info(codec);
+        if (!encoder_info || !encoder_info->hw) continue;
+        if (!probed) {
+            available = probe_available_encoders(config.ffmpeg_path, exe_dir + "encoder_probe.cache");
+            probed = true;
+        }
+        bool found = false;
+        for (const auto& enc : available) {
+            if (codec == enc.codec) found = true;
+        }
+        if (!found) {
+            fprintf(stderr, "Error: encoder '%s' is not available with this FFmpeg/GPU\n", codec.c_str());
+            fprintf(stderr, "Available:");
+            for (const auto& enc : available) fprintf(stderr, " %s", enc.codec);
+            fprintf(stderr, "\n");
+            return 1;
+        }
+    }
 
     // Collect krec files
     std::vector<std::string> krec_files;
@@ -130,6 +465,8 @@ int main(int argc, char* argv[]) {
 
     int success = 0;
     int failed = 0;
+    std::vector<std::string> converted;
+    output_flusher_set_max_active(config.flush_jobs);
 
     for (size_t i = 0; i < krec_files.size(); i++) {
         std::string output;
@@ -138,20 +475,30 @@ int main(int argc, char* argv[]) {
                 ? fs::path(krec_files[i]).parent_path().string()
                 : config.output_path;
             fs::path out_file = fs::path(out_dir) / fs::path(krec_files[i]).stem();
-            out_file.replace_extension(".mp4");
+            out_file.replace_extension(output_extension(config.output_format));
             output = out_file.string();
         } else {
-            output = make_output_path(krec_files[i], config.output_path);
+            output = make_output_path(krec_files[i], config.output_path, config.output_format);
         }
 
         printf("\n[%zu/%zu] ", i + 1, krec_files.size());
         if (convert_one(krec_files[i], output, config)) {
             success++;
+            converted.push_back(krec_files[i]);
         } else {
             failed++;
         }
     }
 
+    // Staged outputs may still be on their way to the output directory
+    std::set<std::string> flush_failed = output_flusher_wait();
+    for (const auto& krec : converted) {
+        if (flush_failed.count(krec)) {
+            success--;
+            failed++;
+        }
+    }
+
     printf("\n=== Summary ===\n");
     printf("Success: %d, Failed: %d, Total: %zu\n", success, failed, krec_files.size());
 
@@ -0,0 +1,107 @@
+#include "output_flusher.h"
+#include "converter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct FlushJob {
+    std::string job;
+    std::string src;
+    std::string dest;
+    std::function<void(bool)> on_done;
+};
+
+static std::mutex s_mutex;
+static std::condition_variable s_cv;
+static std::deque<FlushJob> s_jobs;
+static std::vector<std::thread> s_workers;
+static int s_max_active = 2;
+static std::set<std::string> s_failed_jobs;
+static bool s_stopping = false;
+
+static bool move_file(const std::string& src, const std::string& dest) {
+    std::error_code ec;
+    fs::rename(src, dest, ec);
+    if (!ec) return true;
+
+    // Across volumes: copy under a side name so a half-copied file is never
+    // mistaken for the output, then swap it into place
+    std::string part = dest + ".part";
+    fs::copy_file(src, part, fs::copy_options::overwrite_existing, ec);
+    if (!ec) fs::rename(part, dest, ec);
+    if (ec) {
+        converter_log(LOG_ERROR, "Error: cannot move '%s' to '%s': %s (left in scratch)",
+                      src.c_str(), dest.c_str(), ec.message().c_str());
+        fs::remove(part, ec);
+        return false;
+    }
+    fs::remove(src, ec);
+    return true;
+}
+
+static void flusher_worker() {
+    while (true) {
+        FlushJob job;
+        {
+            std::unique_lock<std::mutex> lock(s_mutex);
+            s_cv.wait(lock, [] { return !s_jobs.empty() || s_stopping; });
+            if (s_jobs.empty()) return;
+            job = std::move(s_jobs.front());
+            s_jobs.pop_front();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok = move_file(job.src, job.dest);
+        if (ok) {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            converter_log(LOG_INFO, "Flushed to: %s (%.1f s)", job.dest.c_str(), seconds);
+        }
+        if (job.on_done) job.on_done(ok);
+
+        if (!ok) {
+            std::lock_guard<std::mutex> lock(s_mutex);
+            s_failed_jobs.insert(job.job);
+        }
+    }
+}
+
+void output_flusher_set_max_active(int max_active) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_max_active = std::max(1, max_active);
+}
+
+void output_flusher_submit(const std::string& job, const std::string& src, const std::string& dest,
+                           std::function<void(bool ok)> on_done) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_jobs.push_back({ job, src, dest, std::move(on_done) });
+    if ((int)s_workers.size() < s_max_active) s_workers.emplace_back(flusher_worker);
+    s_cv.notify_one();
+}
+
+std::set<std::string> output_flusher_wait() {
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if (s_workers.empty()) return {};
+        s_stopping = true;
+        workers.swap(s_workers);
+    }
+    s_cv.notify_all();
+    converter_log(LOG_INFO, "Waiting for scratch flushes to finish...");
+    for (auto& t : workers) t.join();
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_stopping = false;
+    std::set<std::string> failed;
+    failed.swap(s_failed_jobs);
+    return failed;
+}
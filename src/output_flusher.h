@@ -0,0 +1,24 @@
+#pragma once
+#include <functional>
+#include <set>
+#include <string>
+
+// Background mover for outputs staged on local scratch storage (--scratch-dir).
+// Finished files are moved to their destination by worker threads, at most
+// max_active at a time, so a slow network destination never holds up the
+// emulation of the next job.
+
+// Number of concurrent moves (default 2). Takes effect for the next batch of
+// workers, i.e. call it before the first submit.
+void output_flusher_set_max_active(int max_active);
+
+// Queue src to be moved to dest: a rename on the same volume, otherwise a copy
+// to "<dest>.part", a rename into place and removal of src. job names the
+// conversion the file belongs to (its .krec path). on_done runs on the worker
+// thread once the move has finished.
+void output_flusher_submit(const std::string& job, const std::string& src, const std::string& dest,
+                           std::function<void(bool ok)> on_done = nullptr);
+
+// Block until every queued move has finished and stop the workers. Returns
+// the jobs with at least one failed move (their sources are left in place).
+std::set<std::string> output_flusher_wait();
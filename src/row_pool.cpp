@@ -0,0 +1,81 @@
+#include "row_pool.h"
+
+static void band_range(int rows, int bands, int band, int* begin, int* end) {
+    *begin = (int)((long long)rows * band / bands);
+    *end = (int)((long long)rows * (band + 1) / bands);
+}
+
+void RowPool::start(int num_threads) {
+    stop();
+    shutdown = false;
+    generation = 0;
+    band_count = num_threads + 1;
+    for (int i = 0; i < num_threads; i++) {
+        threads.emplace_back(&RowPool::worker, this, i + 1);
+    }
+}
+
+void RowPool::stop() {
+    if (threads.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shutdown = true;
+    }
+    work_cv.notify_all();
+    for (auto& t : threads) {
+        if (t.joinable()) t.join();
+    }
+    threads.clear();
+    band_count = 1;
+}
+
+void RowPool::run(int rows, const std::function<void(int, int)>& fn) {
+    int bands = num_bands();
+    if (bands == 1 || rows < bands) {
+        fn(0, rows);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        job_rows = rows;
+        pending = bands - 1;
+        generation++;
+    }
+    work_cv.notify_all();
+
+    int begin, end;
+    band_range(rows, bands, 0, &begin, &end);
+    fn(begin, end);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [this] { return pending == 0; });
+    job = nullptr;
+}
+
+void RowPool::worker(int band) {
+    unsigned long long seen = 0;
+    while (true) {
+        const std::function<void(int, int)>* fn;
+        int rows;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [&] { return shutdown || generation != seen; });
+            if (shutdown) break;
+            seen = generation;
+            fn = job;
+            rows = job_rows;
+        }
+
+        int begin, end;
+        band_range(rows, num_bands(), band, &begin, &end);
+        (*fn)(begin, end);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending--;
+        }
+        done_cv.notify_one();
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small fixed worker pool that splits a row range into contiguous bands and
+// processes them in parallel. The calling thread always takes the first band,
+// so a pool of N threads gives N+1 bands. With no threads, run() is inline.
+class RowPool {
+public:
+    ~RowPool() { stop(); }
+
+    void start(int num_threads);
+    void stop();
+
+    // Call fn(row_begin, row_end) over [0, rows) and block until every band is done.
+    void run(int rows, const std::function<void(int, int)>& fn);
+
+    int num_bands() const { return band_count; }
+
+private:
+    void worker(int band);
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    const std::function<void(int, int)>* job = nullptr;
+    int job_rows = 0;
+    int band_count = 1;
+    unsigned long long generation = 0;
+    int pending = 0;
+    bool shutdown = false;
+};
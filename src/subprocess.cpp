@@ -0,0 +1,330 @@
+#include "subprocess.h"
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+
+// CreatePipe with an inheritable SECURITY_ATTRIBUTES followed by
+// SetHandleInformation leaves a window where a CreateProcess on another thread
+// picks up our end too, and that child then holds the pipe open past our
+// close. So the pipe starts non-inheritable and only the child's end is
+// duplicated as inheritable.
+bool create_child_pipe(void** read_handle, void** write_handle, bool child_reads, unsigned long size) {
+    HANDLE r = nullptr, w = nullptr;
+    if (!CreatePipe(&r, &w, nullptr, (DWORD)size)) return false;
+    HANDLE& child_end = child_reads ? r : w;
+    HANDLE inheritable = nullptr;
+    if (!DuplicateHandle(GetCurrentProcess(), child_end, GetCurrentProcess(), &inheritable,
+                         0, TRUE, DUPLICATE_SAME_ACCESS)) {
+        CloseHandle(r);
+        CloseHandle(w);
+        return false;
+    }
+    CloseHandle(child_end);
+    child_end = inheritable;
+    *read_handle = r;
+    *write_handle = w;
+    return true;
+}
+
+int run_process(const std::string& cmd, const std::function<void(const char* line)>& on_line) {
+    return run_process_with_input(cmd, nullptr, 0, on_line);
+}
+
+int run_process_with_input(const std::string& cmd, const void* input, size_t bytes,
+                           const std::function<void(const char* line)>& on_line) {
+    HANDLE read_handle = nullptr, write_handle = nullptr;
+    if (!create_child_pipe(&read_handle, &write_handle, false)) return -1;
+
+    HANDLE input_read = nullptr, input_write = nullptr;
+    if (input && !create_child_pipe(&input_read, &input_write, true)) {
+        CloseHandle(read_handle);
+        CloseHandle(write_handle);
+        return -1;
+    }
+
+    STARTUPINFOA si = {};
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = input ? input_read : GetStdHandle(STD_INPUT_HANDLE);
+    si.hStdOutput = write_handle;
+    si.hStdError = write_handle;
+
+    // CreateProcessA may modify the command line buffer
+    std::vector<char> cmd_buf(cmd.begin(), cmd.end());
+    cmd_buf.push_back(0);
+
+    PROCESS_INFORMATION pi = {};
+    BOOL ok = CreateProcessA(nullptr, cmd_buf.data(), nullptr, nullptr, TRUE,
+                             CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi);
+    CloseHandle(write_handle);
+    if (input_read) CloseHandle(input_read);
+
+    if (!ok) {
+        CloseHandle(read_handle);
+        if (input_write) CloseHandle(input_write);
+        return -1;
+    }
+
+    std::thread feeder;
+    if (input_write) {
+        feeder = std::thread([input_write, input, bytes]() {
+            const char* data = (const char*)input;
+            size_t left = bytes;
+            while (left > 0) {
+                DWORD chunk = left > (1u << 20) ? (1u << 20) : (DWORD)left;
+                DWORD written = 0;
+                if (!WriteFile(input_write, data, chunk, &written, nullptr)) break;
+                data += written;
+                left -= written;
+            }
+            CloseHandle(input_write);
+        });
+    }
+
+    char buf[512];
+    DWORD bytes_read;
+    std::string line_buf;
+    while (ReadFile(read_handle, buf, sizeof(buf) - 1, &bytes_read, nullptr) && bytes_read > 0) {
+        buf[bytes_read] = 0;
+        line_buf += buf;
+        // Process complete lines
+        size_t pos;
+        while ((pos = line_buf.find('\n')) != std::string::npos) {
+            std::string line = line_buf.substr(0, pos);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty() && on_line) on_line(line.c_str());
+            line_buf = line_buf.substr(pos + 1);
+        }
+    }
+    if (!line_buf.empty() && on_line) on_line(line_buf.c_str());
+    CloseHandle(read_handle);
+    if (feeder.joinable()) feeder.join();
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    DWORD exit_code = 1;
+    GetExitCodeProcess(pi.hProcess, &exit_code);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    return (int)exit_code;
+}
+
+struct InputProcess {
+    HANDLE process = nullptr;
+    HANDLE input = nullptr;
+};
+
+InputProcess* start_input_process(const std::string& cmd) {
+    HANDLE read_handle = nullptr, write_handle = nullptr;
+    if (!create_child_pipe(&read_handle, &write_handle, true)) return nullptr;
+
+    STARTUPINFOA si = {};
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = read_handle;
+    si.hStdOutput = GetStdHandle(STD_ERROR_HANDLE);
+    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+    std::vector<char> cmd_buf(cmd.begin(), cmd.end());
+    cmd_buf.push_back(0);
+
+    PROCESS_INFORMATION pi = {};
+    BOOL ok = CreateProcessA(nullptr, cmd_buf.data(), nullptr, nullptr, TRUE,
+                             CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi);
+    CloseHandle(read_handle);
+    if (!ok) {
+        CloseHandle(write_handle);
+        return nullptr;
+    }
+    CloseHandle(pi.hThread);
+
+    InputProcess* proc = new InputProcess();
+    proc->process = pi.hProcess;
+    proc->input = write_handle;
+    return proc;
+}
+
+bool input_process_write(InputProcess* proc, const void* data, size_t bytes) {
+    const char* p = (const char*)data;
+    while (bytes > 0) {
+        DWORD chunk = bytes > (1u << 20) ? (1u << 20) : (DWORD)bytes;
+        DWORD written = 0;
+        if (!WriteFile(proc->input, p, chunk, &written, nullptr)) return false;
+        p += written;
+        bytes -= written;
+    }
+    return true;
+}
+
+int finish_input_process(InputProcess* proc) {
+    CloseHandle(proc->input);
+    WaitForSingleObject(proc->process, INFINITE);
+    DWORD exit_code = 1;
+    GetExitCodeProcess(proc->process, &exit_code);
+    CloseHandle(proc->process);
+    delete proc;
+    return (int)exit_code;
+}
+
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+int run_process(const std::string& cmd, const std::function<void(const char* line)>& on_line) {
+    std::string full_cmd = cmd + " 2>&1";
+    FILE* p = popen(full_cmd.c_str(), "r");
+    if (!p) return -1;
+
+    char buf[512];
+    while (fgets(buf, sizeof(buf), p)) {
+        size_t len = strlen(buf);
+        if (len > 0 && buf[len - 1] == '\n') buf[--len] = 0;
+        if (len > 0 && buf[len - 1] == '\r') buf[--len] = 0;
+        if (buf[0] && on_line) on_line(buf);
+    }
+    int status = pclose(p);
+    if (status == -1) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int run_process_with_input(const std::string& cmd, const void* input, size_t bytes,
+                           const std::function<void(const char* line)>& on_line) {
+    if (!input) return run_process(cmd, on_line);
+
+    // A child that exits early must surface as a short write, not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    // Close-on-exec from creation so a concurrent spawn can't inherit either
+    // end; the dup2s below hand the child its copies without the flag
+    int in_fds[2], out_fds[2];
+    if (pipe2(in_fds, O_CLOEXEC) != 0) return -1;
+    if (pipe2(out_fds, O_CLOEXEC) != 0) {
+        close(in_fds[0]);
+        close(in_fds[1]);
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in_fds[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out_fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out_fds[1], STDERR_FILENO);
+
+    char* argv[] = { (char*)"sh", (char*)"-c", (char*)cmd.c_str(), nullptr };
+    pid_t pid = -1;
+    int err = posix_spawn(&pid, "/bin/sh", &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(in_fds[0]);
+    close(out_fds[1]);
+    if (err != 0) {
+        close(in_fds[1]);
+        close(out_fds[0]);
+        return -1;
+    }
+
+    int input_fd = in_fds[1];
+    std::thread feeder([input_fd, input, bytes]() {
+        const char* data = (const char*)input;
+        size_t left = bytes;
+        while (left > 0) {
+            ssize_t n = write(input_fd, data, left);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            data += n;
+            left -= (size_t)n;
+        }
+        close(input_fd);
+    });
+
+    FILE* p = fdopen(out_fds[0], "r");
+    char buf[512];
+    while (p && fgets(buf, sizeof(buf), p)) {
+        size_t len = strlen(buf);
+        if (len > 0 && buf[len - 1] == '\n') buf[--len] = 0;
+        if (len > 0 && buf[len - 1] == '\r') buf[--len] = 0;
+        if (buf[0] && on_line) on_line(buf);
+    }
+    if (p) fclose(p);
+    else close(out_fds[0]);
+    feeder.join();
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+struct InputProcess {
+    pid_t pid = -1;
+    int input = -1;
+};
+
+InputProcess* start_input_process(const std::string& cmd) {
+    // A child that exits early must surface as a failed write, not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    // Our end must not leak into other children, or EOF never arrives; set
+    // close-on-exec atomically since other threads spawn concurrently
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) return nullptr;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, STDERR_FILENO, STDOUT_FILENO);
+
+    std::string shell_cmd = "exec " + cmd;
+    char* argv[] = { (char*)"sh", (char*)"-c", (char*)shell_cmd.c_str(), nullptr };
+    pid_t pid = -1;
+    int err = posix_spawn(&pid, "/bin/sh", &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[0]);
+    if (err != 0) {
+        close(fds[1]);
+        return nullptr;
+    }
+
+    InputProcess* proc = new InputProcess();
+    proc->pid = pid;
+    proc->input = fds[1];
+    return proc;
+}
+
+bool input_process_write(InputProcess* proc, const void* data, size_t bytes) {
+    const char* p = (const char*)data;
+    while (bytes > 0) {
+        ssize_t n = write(proc->input, p, bytes);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+int finish_input_process(InputProcess* proc) {
+    close(proc->input);
+    int status = 0;
+    int exit_code = -1;
+    pid_t waited;
+    while ((waited = waitpid(proc->pid, &status, 0)) < 0 && errno == EINTR) {}
+    if (waited == proc->pid && WIFEXITED(status)) exit_code = WEXITSTATUS(status);
+    delete proc;
+    return exit_code;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+#include <functional>
+#include <string>
+
+// Run a command line and pass each line of its combined stdout/stderr to
+// on_line (may be empty). Returns the exit code, or -1 if it could not start.
+int run_process(const std::string& cmd, const std::function<void(const char* line)>& on_line);
+
+// As run_process, with `bytes` of input fed to the command's stdin from a
+// separate thread (so a child busy writing output can't deadlock against it).
+// stdin is closed once the input has been written.
+int run_process_with_input(const std::string& cmd, const void* input, size_t bytes,
+                           const std::function<void(const char* line)>& on_line);
+
+// A long-running child fed through its stdin while we produce the data. Its
+// stdout/stderr go to our stderr, so pass "-loglevel error" or similar.
+struct InputProcess;
+InputProcess* start_input_process(const std::string& cmd);  // nullptr if it could not start
+bool input_process_write(InputProcess* proc, const void* data, size_t bytes);
+// Close the child's stdin, wait for it and free proc. Returns the exit code (-1 if unknown).
+int finish_input_process(InputProcess* proc);
+
+#ifdef _WIN32
+// Create an anonymous pipe (HANDLEs) where only the child's end is inheritable,
+// so a CreateProcess on another thread can never pick up the parent's end.
+// child_reads picks which end that is; size 0 uses the system default.
+bool create_child_pipe(void** read_handle, void** write_handle, bool child_reads, unsigned long size = 0);
+#endif
@@ -0,0 +1,242 @@
+#include "transcode_queue.h"
+#include "converter.h"
+#include "ffmpeg_encoder.h"
+#include "subprocess.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Idle poll interval in --watch mode
+static const int QUEUE_POLL_SECONDS = 5;
+
+static std::string worker_id() {
+    char host[256] = "host";
+#ifdef _WIN32
+    DWORD size = sizeof(host);
+    GetComputerNameA(host, &size);
+    return std::string(host) + "-" + std::to_string(GetCurrentProcessId());
+#else
+    gethostname(host, sizeof(host) - 1);
+    host[sizeof(host) - 1] = 0;
+    return std::string(host) + "-" + std::to_string(getpid());
+#endif
+}
+
+static std::string to_queue_path(const fs::path& queue_dir, const std::string& path) {
+    std::error_code ec;
+    fs::path rel = fs::relative(path, queue_dir, ec);
+    if (!ec && !rel.empty() && *rel.begin() != "..") return rel.generic_string();
+    return fs::absolute(path, ec).string();
+}
+
+static std::string from_queue_path(const fs::path& queue_dir, const std::string& path) {
+    fs::path p(path);
+    return p.is_absolute() ? p.string() : (queue_dir / p).string();
+}
+
+bool transcode_queue_submit(const std::string& queue_dir, const TranscodeJob& job) {
+    std::error_code ec;
+    fs::create_directories(queue_dir, ec);
+
+    fs::path dir(queue_dir);
+    std::string name = fs::path(job.output).stem().string();
+    fs::path job_path = dir / (name + ".job");
+    for (int n = 2; fs::exists(job_path); n++) {
+        job_path = dir / (name + "-" + std::to_string(n) + ".job");
+    }
+
+    // Write under a temporary name so workers never see a partial job
+    fs::path temp_path = job_path;
+    temp_path += ".tmp";
+    FILE* f = fopen(temp_path.string().c_str(), "w");
+    if (!f) {
+        converter_log(LOG_ERROR, "Error: cannot write transcode job '%s'", temp_path.string().c_str());
+        return false;
+    }
+    fprintf(f, "input=%s\n", to_queue_path(dir, job.input).c_str());
+    fprintf(f, "output=%s\n", to_queue_path(dir, job.output).c_str());
+    fprintf(f, "encoder=%s\n", job.encoder.c_str());
+    fprintf(f, "crf=%d\n", job.crf);
+    fprintf(f, "preset=%s\n", job.preset.c_str());
+    fprintf(f, "threads=%d\n", job.threads);
+    fprintf(f, "bitrate=%d\n", job.bitrate_kbps);
+    if (job.scale_width > 0) {
+        fprintf(f, "scale=%dx%d:%s\n", job.scale_width, job.scale_height, job.scale_flags.c_str());
+    }
+    fclose(f);
+
+    fs::rename(temp_path, job_path, ec);
+    if (ec) {
+        converter_log(LOG_ERROR, "Error: cannot queue transcode job '%s'", job_path.string().c_str());
+        fs::remove(temp_path, ec);
+        return false;
+    }
+    converter_log(LOG_INFO, "Queued transcode job: %s", job_path.string().c_str());
+    return true;
+}
+
+static bool load_job(const fs::path& queue_dir, const fs::path& path, TranscodeJob& job) {
+    FILE* f = fopen(path.string().c_str(), "r");
+    if (!f) return false;
+
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        char* eq = strchr(line, '=');
+        if (!eq) continue;
+        *eq = 0;
+        const char* value = eq + 1;
+        if (strcmp(line, "input") == 0) job.input = from_queue_path(queue_dir, value);
+        else if (strcmp(line, "output") == 0) job.output = from_queue_path(queue_dir, value);
+        else if (strcmp(line, "encoder") == 0) job.encoder = value;
+        else if (strcmp(line, "crf") == 0) job.crf = atoi(value);
+        else if (strcmp(line, "preset") == 0) job.preset = value;
+        else if (strcmp(line, "threads") == 0) job.threads = atoi(value);
+        else if (strcmp(line, "bitrate") == 0) job.bitrate_kbps = atoi(value);
+        else if (strcmp(line, "scale") == 0) {
+            char flags[64] = "lanczos";
+            sscanf(value, "%dx%d:%63s", &job.scale_width, &job.scale_height, flags);
+            job.scale_flags = flags;
+        }
+    }
+    fclose(f);
+    return !job.input.empty() && !job.output.empty();
+}
+
+// Run one ffmpeg command, logging its output verbosely. Returns false (with
+// the last line logged as the error) if it fails.
+static bool run_ffmpeg(const std::string& cmd) {
+    converter_log(LOG_VERBOSE, "Transcode cmd: %s", cmd.c_str());
+
+    std::string last_line;
+    int exit_code = run_process(cmd, [&last_line](const char* line) {
+        last_line = line;
+        converter_log(LOG_VERBOSE, "[FFmpeg] %s", line);
+    });
+    if (exit_code != 0) {
+        converter_log(LOG_ERROR, "Error: transcode failed (%d): %s", exit_code, last_line.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool run_job(const std::string& ffmpeg_path, const TranscodeJob& job) {
+    FFmpegConfig ff;
+    ff.encoder = job.encoder;
+    ff.crf = job.crf;
+    ff.preset = job.preset;
+    ff.threads = job.threads;
+    ff.bitrate_kbps = job.bitrate_kbps;
+
+    // Encode to a side file and rename, so a half-written output is never mistaken for a result
+    std::string part_path = job.output + ".part";
+    std::string input = "\"" + ffmpeg_path + "\" -hide_banner -nostats -y -i \"" + job.input + "\" ";
+    if (job.scale_width > 0) {
+        input += "-vf scale=" + std::to_string(job.scale_width) + ":" + std::to_string(job.scale_height) +
+                 ":flags=" + job.scale_flags + " ";
+    }
+    input += ffmpeg_encoder_flags(ff);
+
+    // Size targets: the intermediate can be read twice, so use a real
+    // two-pass encode where the encoder supports it
+    bool two_pass = job.bitrate_kbps > 0 && encoder_supports_two_pass(job.encoder);
+    std::string passlog = job.output + ".passlog";
+    std::string pass_args;
+    if (two_pass) {
+        converter_log(LOG_INFO, "Two-pass encode at %d kbps", job.bitrate_kbps);
+        if (!run_ffmpeg(input + " -pass 1 -passlogfile \"" + passlog + "\" -an -f null -")) return false;
+        pass_args = " -pass 2 -passlogfile \"" + passlog + "\"";
+    }
+
+    bool ok = run_ffmpeg(input + pass_args + " " + ffmpeg_audio_flags("aac") +
+                         " -f mp4 \"" + part_path + "\"");
+
+    std::error_code ec;
+    if (two_pass) {
+        // libx264 writes <prefix>-0.log and -0.log.mbtree, libvpx <prefix>-0.log
+        fs::remove(passlog + "-0.log", ec);
+        fs::remove(passlog + "-0.log.mbtree", ec);
+        fs::remove(passlog + "-0.log.temp", ec);
+        fs::remove(passlog + "-0.log.mbtree.temp", ec);
+    }
+    if (!ok) {
+        fs::remove(part_path, ec);
+        return false;
+    }
+    fs::rename(part_path, job.output, ec);
+    if (ec) {
+        converter_log(LOG_ERROR, "Error: cannot rename '%s' to '%s'", part_path.c_str(), job.output.c_str());
+        return false;
+    }
+    fs::remove(job.input, ec);
+    return true;
+}
+
+int transcode_queue_run(const std::string& queue_dir, const std::string& ffmpeg_path, bool watch) {
+    fs::path dir(queue_dir);
+    std::string claim_suffix = ".claimed-" + worker_id();
+    int done = 0;
+    int failed = 0;
+
+    while (true) {
+        std::vector<fs::path> jobs;
+        std::error_code ec;
+        for (auto& entry : fs::directory_iterator(dir, ec)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".job") {
+                jobs.push_back(entry.path());
+            }
+        }
+        std::sort(jobs.begin(), jobs.end());
+
+        int claimed = 0;
+        for (const fs::path& job_path : jobs) {
+            // Rename is atomic: only one worker wins each job
+            fs::path claim_path = job_path;
+            claim_path += claim_suffix;
+            fs::rename(job_path, claim_path, ec);
+            if (ec) continue;
+            claimed++;
+
+            TranscodeJob job;
+            bool ok = load_job(dir, claim_path, job);
+            if (ok) {
+                converter_log(LOG_INFO, "Transcoding %s -> %s", job.input.c_str(), job.output.c_str());
+                ok = run_job(ffmpeg_path, job);
+            } else {
+                converter_log(LOG_ERROR, "Error: invalid transcode job '%s'", job_path.string().c_str());
+            }
+
+            if (ok) {
+                fs::remove(claim_path, ec);
+                converter_log(LOG_INFO, "Output saved to: %s", job.output.c_str());
+                done++;
+            } else {
+                fs::path failed_path = job_path;
+                failed_path += ".failed";
+                fs::rename(claim_path, failed_path, ec);
+                failed++;
+            }
+        }
+
+        if (claimed == 0) {
+            if (!watch) break;
+            std::this_thread::sleep_for(std::chrono::seconds(QUEUE_POLL_SECONDS));
+        }
+    }
+
+    converter_log(LOG_INFO, "Transcode queue: %d done, %d failed", done, failed);
+    return failed;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+
+// A deferred encode of a lossless capture into the final output.
+struct TranscodeJob {
+    std::string input;    // lossless intermediate (deleted after a successful transcode)
+    std::string output;   // final file
+    std::string encoder = "libx264";
+    int crf = 23;
+    std::string preset;   // "" = encoder default
+    int threads = 0;
+    int bitrate_kbps = 0; // >0: size-targeted; two-pass where the encoder supports it
+    int scale_width = 0;  // >0: upscale a native-resolution capture to this size
+    int scale_height = 0;
+    std::string scale_flags = "lanczos";
+};
+
+// Write <queue_dir>/<name>.job. Paths inside the queue directory are stored
+// relative to it so the queue can be moved or mounted elsewhere.
+bool transcode_queue_submit(const std::string& queue_dir, const TranscodeJob& job);
+
+// Process jobs in queue_dir until it is empty (or forever with watch). Each
+// job is claimed by renaming it to "<name>.job.claimed-<host>-<pid>", so
+// several workers, on this or other machines, can share one queue. Failed
+// jobs are renamed to "<name>.job.failed"; rename a stale claim back to
+// ".job" to retry it. Returns the number of failed jobs.
+int transcode_queue_run(const std::string& queue_dir, const std::string& ffmpeg_path, bool watch);
@@ -0,0 +1,201 @@
+#include "y4m_writer.h"
+#include "row_pool.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Y4mState {
+    FILE* video = nullptr;
+    FILE* audio = nullptr;
+    bool wav = false;
+    bool audio_seekable = false;
+    unsigned int audio_rate = 0;
+    unsigned long long audio_bytes = 0;
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> frame;  // "FRAME\n" + Y + U + V, written with one fwrite
+    RowPool pool;
+};
+
+static const char FRAME_TAG[] = "FRAME\n";
+static const size_t FRAME_TAG_SIZE = sizeof(FRAME_TAG) - 1;
+
+// Frame rate as a ratio: NTSC-style rates become n*1000/1001
+static void fps_ratio(double fps, int& num, int& den) {
+    double ntsc = fps * 1.001;
+    if (fabs(fps - std::round(fps)) < 1e-6) {
+        num = (int)std::round(fps);
+        den = 1;
+    } else if (fabs(ntsc - std::round(ntsc)) < 0.005) {
+        num = (int)std::round(ntsc) * 1000;
+        den = 1001;
+    } else {
+        num = (int)std::round(fps * 1000);
+        den = 1000;
+        int a = num, b = den;
+        while (b) { int t = a % b; a = b; b = t; }
+        num /= a;
+        den /= a;
+    }
+}
+
+static FILE* open_sink(const std::string& path) {
+    if (is_stream_output(path)) return ffmpeg_open_stream_output(path);
+    return fopen(path.c_str(), "wb");
+}
+
+// 44-byte PCM WAV header. Sizes of 0xFFFFFFFF mean "unknown" for readers of
+// FIFOs and pipes; regular files are patched with the real sizes at close.
+static void write_wav_header(FILE* f, unsigned int rate, unsigned long long data_bytes) {
+    uint32_t data_size = data_bytes > 0xFFFFFFF0ull ? 0xFFFFFFFFu : (uint32_t)data_bytes;
+    uint32_t riff_size = data_size == 0xFFFFFFFFu ? 0xFFFFFFFFu : data_size + 36;
+    uint16_t channels = 2, bits = 16, format = 1;
+    uint16_t block_align = channels * bits / 8;
+    uint32_t byte_rate = rate * block_align;
+    uint32_t fmt_size = 16;
+
+    fwrite("RIFF", 1, 4, f);
+    fwrite(&riff_size, 4, 1, f);
+    fwrite("WAVEfmt ", 1, 8, f);
+    fwrite(&fmt_size, 4, 1, f);
+    fwrite(&format, 2, 1, f);
+    fwrite(&channels, 2, 1, f);
+    fwrite(&rate, 4, 1, f);
+    fwrite(&byte_rate, 4, 1, f);
+    fwrite(&block_align, 2, 1, f);
+    fwrite(&bits, 2, 1, f);
+    fwrite("data", 1, 4, f);
+    fwrite(&data_size, 4, 1, f);
+}
+
+Y4mState* y4m_open(const FFmpegConfig& config) {
+    Y4mState* s = new Y4mState();
+    s->width = config.width;
+    s->height = config.height;
+
+    s->video = open_sink(config.output_path);
+    if (!s->video) {
+        fprintf(stderr, "Error: cannot open Y4M output '%s'\n", config.output_path.c_str());
+        delete s;
+        return nullptr;
+    }
+
+    int num, den;
+    fps_ratio(config.fps, num, den);
+    fprintf(s->video, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg XYSCSS=420JPEG XCOLORRANGE=LIMITED\n",
+            config.width, config.height, num, den);
+
+    if (config.audio_rate > 0 && !config.audio_path.empty()) {
+        s->audio = open_sink(config.audio_path);
+        if (!s->audio) {
+            fprintf(stderr, "Error: cannot open audio output '%s'\n", config.audio_path.c_str());
+            y4m_close(s);
+            return nullptr;
+        }
+        std::string ext = config.audio_path.size() > 4
+            ? config.audio_path.substr(config.audio_path.size() - 4) : "";
+        s->wav = ext == ".wav" || ext == ".WAV";
+        s->audio_rate = config.audio_rate;
+        s->audio_seekable = !is_stream_output(config.audio_path) && fseek(s->audio, 0, SEEK_CUR) == 0;
+        if (s->wav) write_wav_header(s->audio, config.audio_rate, s->audio_seekable ? 0 : ~0ull);
+    }
+
+    size_t luma = (size_t)config.width * config.height;
+    size_t chroma = (size_t)((config.width + 1) / 2) * ((config.height + 1) / 2);
+    s->frame.resize(FRAME_TAG_SIZE + luma + 2 * chroma);
+    memcpy(s->frame.data(), FRAME_TAG, FRAME_TAG_SIZE);
+
+    // Conversion bands: one per ~2 MB of RGB, up to half the cores
+    int wanted = (int)(luma * 3 / (2 * 1024 * 1024));
+    int max_threads = (int)std::thread::hardware_concurrency() / 2;
+    s->pool.start(std::max(0, std::min(wanted, max_threads) - 1));
+
+    fprintf(stderr, "Y4M output: %s (%dx%d, F%d:%d)%s%s\n", config.output_path.c_str(),
+            config.width, config.height, num, den,
+            s->audio ? ", audio: " : "", s->audio ? config.audio_path.c_str() : "");
+    return s;
+}
+
+// BT.601 limited range, 8-bit fixed point. Chroma comes from the average of
+// each 2x2 block (centered siting, matching the C420jpeg tag).
+static void convert_rows(const uint8_t* rgb, int width, int height, uint8_t* y_plane,
+                         uint8_t* u_plane, uint8_t* v_plane, int pair_begin, int pair_end) {
+    size_t stride = (size_t)width * 3;
+    int chroma_width = (width + 1) / 2;
+    for (int pair = pair_begin; pair < pair_end; pair++) {
+        int y0 = pair * 2;
+        int y1 = std::min(y0 + 1, height - 1);
+        const uint8_t* row0 = rgb + y0 * stride;
+        const uint8_t* row1 = rgb + y1 * stride;
+        uint8_t* out0 = y_plane + (size_t)y0 * width;
+        uint8_t* out1 = y_plane + (size_t)y1 * width;
+        uint8_t* u = u_plane + (size_t)pair * chroma_width;
+        uint8_t* v = v_plane + (size_t)pair * chroma_width;
+
+        for (int x = 0; x < width; x += 2) {
+            int x1 = std::min(x + 1, width - 1);
+            const uint8_t* p[4] = { row0 + x * 3, row0 + x1 * 3, row1 + x * 3, row1 + x1 * 3 };
+            int luma[4];
+            for (int i = 0; i < 4; i++) {
+                luma[i] = ((66 * p[i][0] + 129 * p[i][1] + 25 * p[i][2] + 128) >> 8) + 16;
+            }
+            out0[x] = (uint8_t)luma[0];
+            out0[x1] = (uint8_t)luma[1];
+            out1[x] = (uint8_t)luma[2];
+            out1[x1] = (uint8_t)luma[3];
+
+            int r = p[0][0] + p[1][0] + p[2][0] + p[3][0];
+            int g = p[0][1] + p[1][1] + p[2][1] + p[3][1];
+            int b = p[0][2] + p[1][2] + p[2][2] + p[3][2];
+            u[x / 2] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+            v[x / 2] = (uint8_t)(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+        }
+    }
+}
+
+bool y4m_write_frame(Y4mState* s, const uint8_t* rgb_data, int width, int height) {
+    if (!s || width != s->width || height != s->height) return false;
+
+    size_t luma = (size_t)width * height;
+    size_t chroma = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+    uint8_t* y_plane = s->frame.data() + FRAME_TAG_SIZE;
+    uint8_t* u_plane = y_plane + luma;
+    uint8_t* v_plane = u_plane + chroma;
+    s->pool.run((height + 1) / 2, [=](int begin, int end) {
+        convert_rows(rgb_data, width, height, y_plane, u_plane, v_plane, begin, end);
+    });
+
+    if (fwrite(s->frame.data(), 1, s->frame.size(), s->video) != s->frame.size()) {
+        fprintf(stderr, "Error: failed to write Y4M frame\n");
+        return false;
+    }
+    return true;
+}
+
+bool y4m_write_audio(Y4mState* s, const uint8_t* pcm, size_t bytes) {
+    if (!s || !s->audio) return false;
+    if (fwrite(pcm, 1, bytes, s->audio) != bytes) {
+        fprintf(stderr, "Error: failed to write audio output\n");
+        return false;
+    }
+    s->audio_bytes += bytes;
+    return true;
+}
+
+void y4m_close(Y4mState* s) {
+    if (!s) return;
+    s->pool.stop();
+    if (s->video) fclose(s->video);
+    if (s->audio) {
+        if (s->wav && s->audio_seekable && fseek(s->audio, 0, SEEK_SET) == 0) {
+            write_wav_header(s->audio, s->audio_rate, s->audio_bytes);
+        }
+        fclose(s->audio);
+    }
+    delete s;
+}
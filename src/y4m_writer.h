@@ -0,0 +1,17 @@
+#pragma once
+#include "ffmpeg_encoder.h"
+
+// Raw stream backend (EncoderBackend::Y4M). Frames are converted on the host
+// to 8-bit YUV 4:2:0 (BT.601, limited range, centered chroma) and written as a
+// YUV4MPEG2 stream to a file, FIFO, "-" or "pipe:N", for external encoders
+// that read Y4M. No ffmpeg process is involved. Live audio goes to its own
+// sink (FFmpegConfig::audio_path): a WAV file for ".wav" paths, raw s16le
+// stereo otherwise. FIFOs block on open until the reader arrives, video first.
+
+struct Y4mState;
+
+Y4mState* y4m_open(const FFmpegConfig& config);
+bool y4m_write_frame(Y4mState* state, const uint8_t* rgb_data, int width, int height);
+// Interleaved s16le stereo at FFmpegConfig::audio_rate; false without an audio sink.
+bool y4m_write_audio(Y4mState* state, const uint8_t* pcm, size_t bytes);
+void y4m_close(Y4mState* state);